@@ -0,0 +1,243 @@
+/*
+ * AhoCorasick.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Aho-Corasick automaton over the nodes of a DoubleArray.
+ *
+ * The goto function is the BASE/CHECK transition of the double array
+ * itself. This class adds three values for each node in a mapped array:
+ *
+ *   FAIL:   the node for the longest proper suffix of this node's string
+ *           which is also in the trie.
+ *   OUTPUT: the nearest node which ends a key, starting from this node
+ *           and following FAIL (0 if none).
+ *   DEPTH:  the length of this node's string.
+ *
+ * The file begins with a LinkHeader, which records "pair", "serial",
+ * DA_SIZE and NUM_KEY of the double array when the links were built. Any
+ * update of the double array (even one which keeps its size and number of
+ * keys, e.g. Remove() followed by Add(), or Relayout()) increases
+ * "serial", and the links must be rebuilt by Build(). The file is only a
+ * cache, so a file of another format is taken as stale, not rejected.
+ */
+
+#ifndef _MADA_AHO_CORASICK_HPP_
+#define _MADA_AHO_CORASICK_HPP_
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include "MappedArray.hpp"
+#include "DoubleArray.hpp"
+#include "FileHeader.hpp"
+
+#define MADA_LINK_MAGIC "MaDaAC\0\0"
+
+namespace mada
+{
+struct LinkHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endian; // MADA_ENDIAN_MARK in the byte order of the writer
+    uint32_t index_size; // sizeof(IndexType)
+    uint32_t pair; // "pair" of the double array at Build()
+    uint64_t serial; // "serial" of the double array at Build()
+    int64_t da_size; // DA_SIZE at Build()
+    int64_t num_key; // NUM_KEY at Build()
+    char reserved[16];
+};
+
+template <class IndexType, class KeyType> class AhoCorasick
+{
+private:
+    const DoubleArray<IndexType, KeyType> &da;
+    MappedArray<IndexType> link;
+
+    LinkHeader *Header()
+    { return static_cast<LinkHeader *>(link.header()); }
+    const LinkHeader *Header() const
+    { return static_cast<const LinkHeader *>(link.header()); }
+
+    IndexType &Fail(IndexType s) { return link[3*s]; }
+    IndexType &Output(IndexType s) { return link[3*s+1]; }
+    IndexType &Depth(IndexType s) { return link[3*s+2]; }
+    IndexType Fail(IndexType s) const { return link[3*s]; }
+    IndexType Output(IndexType s) const { return link[3*s+1]; }
+    IndexType Depth(IndexType s) const { return link[3*s+2]; }
+
+    // Copy is forbidden.
+    AhoCorasick(const AhoCorasick &a);
+    AhoCorasick &operator=(const AhoCorasick &a);
+public:
+    AhoCorasick(const DoubleArray<IndexType, KeyType> &da, const char *linkfile);
+    ~AhoCorasick();
+
+    int IsValid();
+    void Build();
+
+    template <class Callback>
+    size_t Match(const KeyType *text, size_t len, Callback &callback) const;
+};
+
+template <class IndexType, class KeyType>
+AhoCorasick<IndexType, KeyType>::AhoCorasick(const DoubleArray<IndexType, KeyType> &da,
+					     const char *linkfile) :
+    da(da),
+    link(linkfile, sizeof(LinkHeader))
+{
+}
+
+template <class IndexType, class KeyType>
+AhoCorasick<IndexType, KeyType>::~AhoCorasick()
+{
+    // MappedArray needs at least one element after the header.
+    link.truncate(IsValid() ? 3*(Header()->da_size+1) : 1);
+}
+
+/*
+ * This method returns 1 if the links were built for the current state of
+ * the double array. Otherwise, it returns 0.
+ */
+template <class IndexType, class KeyType>
+int AhoCorasick<IndexType, KeyType>::IsValid()
+{
+    const LinkHeader *h = Header();
+
+    return memcmp(h->magic, MADA_LINK_MAGIC, sizeof(h->magic)) == 0 &&
+	h->version == MADA_VERSION &&
+	h->endian == MADA_ENDIAN_MARK &&
+	h->index_size == sizeof(IndexType) &&
+	h->pair == da.Header()->pair &&
+	h->serial == da.Header()->serial &&
+	h->da_size == da.Header()->da_size &&
+	h->num_key == da.Header()->num_key;
+}
+
+/*
+ * This method computes FAIL, OUTPUT and DEPTH of all nodes in breadth
+ * first order, so that FAIL of the parent is always computed before its
+ * children.
+ */
+template <class IndexType, class KeyType>
+void AhoCorasick<IndexType, KeyType>::Build()
+{
+    vector<IndexType> queue;
+
+    link.clear();
+    link.expand_to(3*(da.Header()->da_size+1));
+
+    Fail(1) = 1;
+    Output(1) = 0; // the empty key is never reported.
+    Depth(1) = 0;
+    queue.push_back(1);
+
+    for (size_t head = 0; head < queue.size(); head++) {
+	IndexType s = queue[head];
+
+	if (da.base[s] <= 0)
+	    continue;
+
+	for (KeyType a=1; a<=da.max; a++) {
+	    IndexType t = da.base[s] + a;
+
+	    if (a != da.term && 0 < t && t <= da.Header()->da_size &&
+		da.check[t] == s) {
+		IndexType f = s, u = 0;
+
+		if (s != 1) {
+		    do {
+			f = Fail(f);
+			u = da.Forward(f, a);
+		    } while (u == 0 && f != 1);
+		}
+
+		Fail(t) = u ? u : 1;
+		Output(t) = da.Forward(t, da.term) ? t : Output(Fail(t));
+		Depth(t) = Depth(s) + 1;
+		queue.push_back(t);
+	    }
+
+	    if (a == da.max)
+		break;
+	}
+    }
+
+    // The header is written last, so that the links are never taken as
+    // valid before they are complete.
+    memset(Header(), 0, sizeof(LinkHeader));
+    memcpy(Header()->magic, MADA_LINK_MAGIC, sizeof(Header()->magic));
+    Header()->version = MADA_VERSION;
+    Header()->endian = MADA_ENDIAN_MARK;
+    Header()->index_size = sizeof(IndexType);
+    Header()->pair = da.Header()->pair;
+    Header()->serial = da.Header()->serial;
+    Header()->da_size = da.Header()->da_size;
+    Header()->num_key = da.Header()->num_key;
+}
+
+/*
+ * This method finds all occurrences of keys in the specified text in one
+ * pass, and returns the number of occurrences.
+ *
+ * For each occurrence, callback(pos, len, index) is called, where "pos"
+ * is the offset of the occurrence in the text, "len" is the length of the
+ * key and "index" is the index of the leaf node (which Search() returns).
+ * Occurrences are reported in the order of their end positions.
+ *
+ * Arguments:
+ *   text: Text to be scanned. The terminal symbol in the text never
+ *         matches and resets the automaton.
+ *   len:  The length of the text.
+ */
+template <class IndexType, class KeyType>
+template <class Callback>
+size_t AhoCorasick<IndexType, KeyType>::Match(const KeyType *text, size_t len,
+					      Callback &callback) const
+{
+    IndexType s = 1;
+    size_t count = 0;
+
+    for (size_t i = 0; i < len; i++) {
+	KeyType c = text[i];
+	IndexType t;
+
+	if (c == da.term) {
+	    s = 1;
+	    continue;
+	}
+
+	while ((t = da.Forward(s, c)) == 0 && s != 1)
+	    s = Fail(s);
+	s = t ? t : 1;
+
+	for (IndexType o = Output(s); o; o = Output(Fail(o))) {
+	    callback(i + 1 - Depth(o), Depth(o), da.Forward(o, da.term));
+	    count++;
+	}
+    }
+
+    return count;
+}
+
+}
+
+#endif // _MADA_AHO_CORASICK_HPP_
@@ -0,0 +1,236 @@
+/*
+ * Attributes.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Records of attributes indexed by key id, in a mapped file next to the
+ * BASE and CHECK files.
+ *
+ * T is a plain struct (e.g. a POS tag, a cost and a frequency), which is
+ * copied to the file as is. After a lookup, the attributes of a key are
+ * one array index away:
+ *
+ *   Attributes<int, unsigned char, Entry> attr(da, "attr");
+ *   IndexType id = da.SearchId(key);
+ *   if (id >= 0)
+ *       cost = attr[id].cost;
+ *
+ * An id freed by DoubleArray::Remove() is given to the next new key, so
+ * the record of a removed key must not be left behind. Add() and Remove()
+ * of this class erase the record of a new or removed key; after
+ * DoubleArray::Add(a, &id) returns 1, call Erase(id).
+ *
+ * The file begins with an AttributeHeader, which records sizeof(T) and
+ * the "pair" value of the double array. Build() of the double array gives
+ * new ids and a new "pair", and IsValid() then returns 0 until Reset().
+ * Relayout() keeps both.
+ */
+
+#ifndef _MADA_ATTRIBUTES_HPP_
+#define _MADA_ATTRIBUTES_HPP_
+
+#include <stdint.h>
+#include <string.h>
+#include "MappedArray.hpp"
+#include "DoubleArray.hpp"
+#include "FileHeader.hpp"
+
+#define MADA_ATTR_MAGIC "MaDaAT\0\0"
+
+namespace mada
+{
+struct AttributeHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endian; // MADA_ENDIAN_MARK in the byte order of the writer
+    uint32_t record_size; // sizeof(T)
+    uint32_t pair; // "pair" of the double array at Reset()
+    int64_t size; // the number of records
+    char reserved[32];
+};
+
+template <class IndexType, class KeyType, class T> class Attributes
+{
+private:
+    DoubleArray<IndexType, KeyType> &da;
+
+    // Records are stored as bytes, since MappedArray fills new elements
+    // by assigning 0.
+    MappedArray<char> records;
+
+    AttributeHeader *Header()
+    { return static_cast<AttributeHeader *>(records.header()); }
+
+    // Copy is forbidden.
+    Attributes(const Attributes &a);
+    Attributes &operator=(const Attributes &a);
+public:
+    Attributes(DoubleArray<IndexType, KeyType> &da, const char *file);
+    ~Attributes();
+
+    int IsValid();
+    void Reset();
+
+    T &operator[](IndexType id);
+    T *Find(const KeyType *a);
+    IndexType Size() { return Header()->size; }
+
+    void Erase(IndexType id);
+    IndexType Add(const KeyType *a);
+    IndexType Remove(const KeyType *a);
+};
+
+/*
+ * Open the records in "file". A new file is reset for the current ids of
+ * the double array.
+ *
+ * Exceptions:
+ *   2: The header doesn't match (magic, version, byte order or sizeof(T)).
+ *   Others: See MappedArray.
+ */
+template <class IndexType, class KeyType, class T>
+Attributes<IndexType, KeyType, T>::Attributes(DoubleArray<IndexType, KeyType> &da,
+					      const char *file) :
+    da(da),
+    records(file, sizeof(AttributeHeader))
+{
+    if (Header()->magic[0] == 0) {
+	Reset();
+	return;
+    }
+
+    if (memcmp(Header()->magic, MADA_ATTR_MAGIC, sizeof(Header()->magic)) ||
+	Header()->version != MADA_VERSION ||
+	Header()->endian != MADA_ENDIAN_MARK ||
+	Header()->record_size != sizeof(T) ||
+	Header()->size < 0)
+	throw 2;
+}
+
+template <class IndexType, class KeyType, class T>
+Attributes<IndexType, KeyType, T>::~Attributes()
+{
+    // MappedArray needs at least one element after the header.
+    records.truncate(Header()->size ? Header()->size * sizeof(T) : 1);
+}
+
+/*
+ * This method returns 1 if the records belong to the current ids of the
+ * double array. Otherwise, it returns 0.
+ */
+template <class IndexType, class KeyType, class T>
+int Attributes<IndexType, KeyType, T>::IsValid()
+{
+    return Header()->pair == da.Header()->pair;
+}
+
+/*
+ * Remove all records, and bind this file to the current ids of the
+ * double array.
+ */
+template <class IndexType, class KeyType, class T>
+void Attributes<IndexType, KeyType, T>::Reset()
+{
+    records.clear();
+
+    memset(Header(), 0, sizeof(AttributeHeader));
+    memcpy(Header()->magic, MADA_ATTR_MAGIC, sizeof(Header()->magic));
+    Header()->version = MADA_VERSION;
+    Header()->endian = MADA_ENDIAN_MARK;
+    Header()->record_size = sizeof(T);
+    Header()->pair = da.Header()->pair;
+    Header()->size = 0;
+}
+
+/*
+ * Return the record of the specified id. The file is expanded if needed,
+ * and new records are filled with 0. Expanding the file may map it to
+ * another address, so that a reference (or a pointer from Find()) is
+ * invalid after the next call with an id beyond Size().
+ */
+template <class IndexType, class KeyType, class T>
+T &Attributes<IndexType, KeyType, T>::operator[](IndexType id)
+{
+    if (id >= Header()->size) {
+	records.expand_to((id + 1) * sizeof(T));
+	Header()->size = id + 1;
+    }
+
+    return *reinterpret_cast<T *>(&records[id * sizeof(T)]);
+}
+
+/*
+ * Return the record of the specified key, or NULL if it is not found.
+ */
+template <class IndexType, class KeyType, class T>
+T *Attributes<IndexType, KeyType, T>::Find(const KeyType *a)
+{
+    IndexType id = da.SearchId(a);
+
+    return id < 0 ? NULL : &(*this)[id];
+}
+
+/*
+ * Fill the record of the specified id with 0, if it exists.
+ */
+template <class IndexType, class KeyType, class T>
+void Attributes<IndexType, KeyType, T>::Erase(IndexType id)
+{
+    if (0 <= id && id < Header()->size)
+	memset(&records[id * sizeof(T)], 0, sizeof(T));
+}
+
+/*
+ * Add the key to the double array. If it is new, its record is erased,
+ * since its id may have belonged to a removed key. The return value is
+ * that of DoubleArray::Add().
+ */
+template <class IndexType, class KeyType, class T>
+IndexType Attributes<IndexType, KeyType, T>::Add(const KeyType *a)
+{
+    IndexType id = -1;
+    IndexType ret = da.Add(a, &id);
+
+    if (ret > 0)
+	Erase(id);
+
+    return ret;
+}
+
+/*
+ * Remove the key from the double array, and erase its record. The return
+ * value is that of DoubleArray::Remove().
+ */
+template <class IndexType, class KeyType, class T>
+IndexType Attributes<IndexType, KeyType, T>::Remove(const KeyType *a)
+{
+    IndexType id = da.SearchId(a);
+    IndexType ret = da.Remove(a);
+
+    if (ret > 0)
+	Erase(id);
+
+    return ret;
+}
+
+}
+
+#endif // _MADA_ATTRIBUTES_HPP_
@@ -0,0 +1,235 @@
+/*
+ * CheckScan.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Evaluation of eight candidate BASE values at once for X_Check.
+ *
+ * BusyMask8(p, labels, n) returns a mask whose bit j is set if
+ * p[j + c] > 0 for some label c, i.e. base q+j collides with a used
+ * cell when p is &check[q]. For each label the eight cells
+ * p[c] ... p[c+7] are contiguous, so one or two vector loads and a
+ * signed compare cover all candidates.
+ *
+ * The vector code is selected at compile time. SSE2 is always present
+ * on x86-64. Build with -mavx2 (or -msse4.2 for 64-bit indexes) to use
+ * the wider paths. Defining MADA_NO_SIMD forces the scalar loop.
+ * Without these flags, test.exe uses SSE2 and test64.exe the scalar
+ * loop; "make simd" builds test-avx2.exe and test64-avx2.exe.
+ *
+ * The scalar loop stops at the first candidate that fits, so bits above
+ * it are left clear. Only the lowest clear bit is meaningful to callers.
+ *
+ * The caller must make sure that p[c+7] is inside the array for every
+ * label c.
+ *
+ * EqualMask8(p, s) returns a mask whose bit j is set if p[j] == s, i.e.
+ * cell j is a child of node s when p points into CHECK. GetChildren()
+ * scans the cells of all labels with it.
+ */
+
+#ifndef _MADA_CHECK_SCAN_HPP_
+#define _MADA_CHECK_SCAN_HPP_
+
+#include <stddef.h>
+
+#if !defined(MADA_NO_SIMD) && defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace mada
+{
+
+#define MADA_BUSY_ALL 0xffu
+
+template <class IndexType, class KeyType>
+inline unsigned int BusyMask8(const IndexType *p, const KeyType *labels,
+			      size_t n)
+{
+    unsigned int busy = 0;
+
+    // Without vectors each candidate stops at its first used cell.
+    for (int j = 0; j < 8; j++) {
+	for (size_t i = 0; i < n; i++) {
+	    if (p[j + labels[i]] > 0) {
+		busy |= 1u << j;
+		break;
+	    }
+	}
+
+	if (!(busy & (1u << j)))
+	    break;
+    }
+
+    return busy;
+}
+
+template <class IndexType>
+inline unsigned int EqualMask8(const IndexType *p, IndexType s)
+{
+    unsigned int equal = 0;
+
+    for (int j = 0; j < 8; j++)
+	if (p[j] == s)
+	    equal |= 1u << j;
+
+    return equal;
+}
+
+#if !defined(MADA_NO_SIMD) && defined(__SSE2__)
+
+template <class KeyType>
+inline unsigned int BusyMask8(const int *p, const KeyType *labels, size_t n)
+{
+    unsigned int busy = 0;
+
+#ifdef __AVX2__
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (size_t i = 0; i < n && busy != MADA_BUSY_ALL; i++) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) (p + labels[i]));
+
+	busy |= _mm256_movemask_ps(
+	    _mm256_castsi256_ps(_mm256_cmpgt_epi32(v, zero)));
+    }
+#else
+    const __m128i zero = _mm_setzero_si128();
+
+    for (size_t i = 0; i < n && busy != MADA_BUSY_ALL; i++) {
+	const int *q = p + labels[i];
+	__m128i lo = _mm_loadu_si128((const __m128i *) q);
+	__m128i hi = _mm_loadu_si128((const __m128i *) (q + 4));
+
+	busy |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(lo, zero)))
+	    | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(hi, zero))) << 4;
+    }
+#endif
+
+    return busy;
+}
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+
+template <class KeyType>
+inline unsigned int BusyMask8(const long long *p, const KeyType *labels,
+			      size_t n)
+{
+    unsigned int busy = 0;
+
+#ifdef __AVX2__
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (size_t i = 0; i < n && busy != MADA_BUSY_ALL; i++) {
+	const long long *q = p + labels[i];
+	__m256i lo = _mm256_loadu_si256((const __m256i *) q);
+	__m256i hi = _mm256_loadu_si256((const __m256i *) (q + 4));
+
+	busy |= _mm256_movemask_pd(
+	    _mm256_castsi256_pd(_mm256_cmpgt_epi64(lo, zero)))
+	    | _mm256_movemask_pd(
+		_mm256_castsi256_pd(_mm256_cmpgt_epi64(hi, zero))) << 4;
+    }
+#else
+    const __m128i zero = _mm_setzero_si128();
+
+    for (size_t i = 0; i < n && busy != MADA_BUSY_ALL; i++) {
+	const long long *q = p + labels[i];
+
+	for (int j = 0; j < 4; j++) {
+	    __m128i v = _mm_loadu_si128((const __m128i *) (q + 2*j));
+
+	    busy |= _mm_movemask_pd(
+		_mm_castsi128_pd(_mm_cmpgt_epi64(v, zero))) << (2*j);
+	}
+    }
+#endif
+
+    return busy;
+}
+
+#endif // __AVX2__ || __SSE4_2__
+
+inline unsigned int EqualMask8(const int *p, int s)
+{
+#ifdef __AVX2__
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+
+    return _mm256_movemask_ps(
+	_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, _mm256_set1_epi32(s))));
+#else
+    const __m128i key = _mm_set1_epi32(s);
+    __m128i lo = _mm_loadu_si128((const __m128i *) p);
+    __m128i hi = _mm_loadu_si128((const __m128i *) (p + 4));
+
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lo, key)))
+	| _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(hi, key))) << 4;
+#endif
+}
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+
+inline unsigned int EqualMask8(const long long *p, long long s)
+{
+    unsigned int equal = 0;
+
+#ifdef __AVX2__
+    const __m256i key = _mm256_set1_epi64x(s);
+
+    for (int j = 0; j < 2; j++) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) (p + 4*j));
+
+	equal |= _mm256_movemask_pd(
+	    _mm256_castsi256_pd(_mm256_cmpeq_epi64(v, key))) << (4*j);
+    }
+#else
+    const __m128i key = _mm_set1_epi64x(s);
+
+    for (int j = 0; j < 4; j++) {
+	__m128i v = _mm_loadu_si128((const __m128i *) (p + 2*j));
+
+	equal |= _mm_movemask_pd(
+	    _mm_castsi128_pd(_mm_cmpeq_epi64(v, key))) << (2*j);
+    }
+#endif
+
+    return equal;
+}
+
+#endif // __AVX2__ || __SSE4_1__
+
+#endif // !MADA_NO_SIMD && __SSE2__
+
+/*
+ * Index of the lowest clear bit of a mask returned by BusyMask8().
+ * The mask must not be MADA_BUSY_ALL.
+ */
+inline int FirstIdle8(unsigned int busy)
+{
+    int j = 0;
+
+    while (busy & (1u << j))
+	j++;
+
+    return j;
+}
+
+} // namespace mada
+
+#endif // _MADA_CHECK_SCAN_HPP_
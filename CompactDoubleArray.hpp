@@ -0,0 +1,248 @@
+/*
+ * CompactDoubleArray.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read-only double array with 4 bytes per cell.
+ *
+ * Each cell packs a 24-bit BASE and an 8-bit label which replaces CHECK:
+ *
+ *   bit 31            8 7       0
+ *      |     BASE      |  LABEL  |
+ *
+ * A label-only CHECK is sound only if no two nodes share the same BASE.
+ * Therefore this array is never updated in place. It is rebuilt from a
+ * DoubleArray by Build(), which gives a unique BASE to every node that
+ * has children. Unused cells, the header cells and the root have label 0,
+ * which is never a valid transition.
+ *
+ * Cell 0 holds the number of cells and cell 1 holds the number of keys.
+ * Both are stored in the BASE field. The root is cell 2.
+ *
+ * Warning:
+ *  KeyType must be unsigned value and every label must fit in 8 bits.
+ */
+
+#ifndef _MADA_COMPACT_DOUBLE_ARRAY_HPP_
+#define _MADA_COMPACT_DOUBLE_ARRAY_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include <utility>
+#include "MappedArray.hpp"
+#include "DoubleArray.hpp"
+
+namespace mada
+{
+template <class KeyType> class CompactDoubleArray
+{
+private:
+    enum {
+	ROOT = 2,
+	MAX_INDEX = 0xffffff, // the maximal index which fits in 24 bits
+	MAX_LABEL = 0xff,
+	MAX_MISSES = 0xff // a free cell which fails this often is not tried
+    };
+
+    MappedArray<uint32_t> unit;
+    KeyType term; // terminal symbol
+
+    uint32_t GetBase(uint32_t index) const { return unit[index] >> 8; }
+    uint32_t GetLabel(uint32_t index) const { return unit[index] & MAX_LABEL; }
+    uint32_t GetSize() const { return GetBase(0); }
+    uint32_t GetNumKey() const { return GetBase(1); }
+public:
+    CompactDoubleArray(const char *unitfile, KeyType term);
+    ~CompactDoubleArray();
+
+    template <class IndexType>
+    uint32_t Build(const DoubleArray<IndexType, KeyType> &da);
+    uint32_t Search(const KeyType *a) const;
+
+    void printInfo() const;
+};
+
+template <class KeyType>
+CompactDoubleArray<KeyType>::CompactDoubleArray(const char *unitfile,
+						KeyType term) :
+    unit(unitfile)
+{
+    if (term <= 0)
+	throw 1; /* terminal symbol must be greater than 0. */
+
+    this->term = term;
+}
+
+template <class KeyType>
+CompactDoubleArray<KeyType>::~CompactDoubleArray()
+{
+    if (GetSize())
+	unit.truncate(GetSize());
+}
+
+/*
+ * This method replaces the content of this array with all keys stored in
+ * the specified double array. It returns the number of keys.
+ *
+ * Nodes are placed in breadth-first order. For each node, the free cells
+ * are tried in order as the position of its smallest child, and the BASE is
+ * accepted if it is not used by any other node and all children fit in
+ * free cells.
+ *
+ * Exceptions:
+ *   1: The maximal label of "da" does not fit in 8 bits.
+ *   2: An index exceeds 24 bits. The double array is too large.
+ */
+template <class KeyType>
+template <class IndexType>
+uint32_t CompactDoubleArray<KeyType>::Build(const DoubleArray<IndexType, KeyType> &da)
+{
+    if (da.max > MAX_LABEL || term != da.term)
+	throw 1;
+
+    vector<char> used(ROOT+1, 1); // cell is already occupied
+    vector<char> base_used(1, 1); // BASE is taken (0 means "no child")
+    vector<pair<IndexType, uint32_t> > queue;
+    KeyType labels[MAX_LABEL+1];
+    uint32_t size = ROOT + 1;
+    uint32_t keys = 0;
+
+    // next_free skips used cells, as in DoubleArray::BuildShard(). A free
+    // cell is also skipped after it failed MAX_MISSES times, e.g. because
+    // BASE is taken for the label which comes first in most nodes.
+    vector<IndexType> next_free(ROOT+2);
+    vector<unsigned char> misses(ROOT+2, 0);
+    for (IndexType i = 0; i <= ROOT+1; i++)
+	next_free[i] = i < ROOT+1 ? i+1 : i;
+
+    unit.clear();
+    queue.push_back(make_pair(static_cast<IndexType>(1),
+			      static_cast<uint32_t>(ROOT)));
+
+    for (size_t head = 0; head < queue.size(); head++) {
+	IndexType s = queue[head].first;
+	uint32_t d = queue[head].second;
+	size_t n = da.GetChildren(s, labels);
+
+	if (n == 0)
+	    continue; // a branch left by Remove()
+
+	uint32_t q;
+	for (IndexType p = DoubleArray<IndexType, KeyType>::FindFree(
+		 next_free, labels[0]+1); ;
+	     p = DoubleArray<IndexType, KeyType>::FindFree(next_free, p+1)) {
+	    q = p - labels[0];
+
+	    int fits = q >= base_used.size() || !base_used[q];
+	    for (size_t i = 0; fits && i < n; i++)
+		if (q+labels[i] < used.size() && used[q+labels[i]])
+		    fits = 0;
+
+	    if (fits)
+		break;
+
+	    if ((size_t) p < misses.size() && ++misses[p] == MAX_MISSES)
+		next_free[p] = p + 1;
+	}
+
+	uint32_t last = q + labels[n-1];
+	if (last > MAX_INDEX)
+	    throw 2;
+
+	if (used.size() <= last) {
+	    used.resize(last+1, 0);
+
+	    for (IndexType i = next_free.size(); i <= (IndexType) last; i++)
+		next_free.push_back(i);
+	    misses.resize(last+1, 0);
+	}
+	if (base_used.size() <= q)
+	    base_used.resize(q+1, 0);
+	if (size <= last)
+	    size = last + 1;
+
+	base_used[q] = 1;
+	unit.expand_to(last);
+	unit[d] = (q << 8) | GetLabel(d);
+
+	for (size_t i = 0; i < n; i++) {
+	    uint32_t t = q + labels[i];
+
+	    used[t] = 1;
+	    next_free[t] = t + 1;
+	    unit[t] = labels[i];
+
+	    if (da.base[da.base[s] + labels[i]] < 0)
+		keys++;
+	    else
+		queue.push_back(make_pair(da.base[s] + labels[i], t));
+	}
+    }
+
+    unit[0] = size << 8;
+    unit[1] = keys << 8;
+
+    return keys;
+}
+
+/*
+ * This method check if a key is included in this array. If the specified
+ * key is found, this method returns the index of the leaf node. Otherwise,
+ * it returns 0.
+ *
+ * Argument:
+ *   a: Key to be searched.
+ *      The end of this string must be ended with terminal symbol "term".
+ */
+template <class KeyType>
+uint32_t CompactDoubleArray<KeyType>::Search(const KeyType *a) const
+{
+    if (!GetNumKey())
+	return 0;
+
+    uint32_t size = GetSize();
+    uint32_t index = ROOT;
+
+    for (size_t pos = 0; ; pos++) {
+	uint32_t t = GetBase(index) + a[pos];
+
+	if (a[pos] == 0 || t >= size || GetLabel(t) != a[pos])
+	    return 0;
+
+	index = t;
+	if (a[pos] == term)
+	    return index;
+    }
+}
+
+template <class KeyType>
+void CompactDoubleArray<KeyType>::printInfo() const
+{
+    printf ("Size of cell: %lu bytes\n",
+	    (unsigned long) sizeof(uint32_t));
+    printf ("Size of array: %lu (%lu bytes)\n",
+	    (unsigned long) GetSize(),
+	    (unsigned long) GetSize() * sizeof(uint32_t));
+    printf ("The number of keys: %lu\n", (unsigned long) GetNumKey());
+}
+
+}
+
+#endif // _MADA_COMPACT_DOUBLE_ARRAY_HPP_
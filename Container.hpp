@@ -0,0 +1,487 @@
+/*
+ * Container.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Many named dictionaries in one read-only file.
+ *
+ * A container holds named sections. A section is a snapshot image of a
+ * double array (see Snapshot), or any other bytes such as the records of
+ * Attributes or a KeyFilter file. The file is written once by
+ * ContainerWriter:
+ *
+ *   ContainerWriter w("dicts.pack");
+ *   w.Add("ja", da);
+ *   w.AddFile("ja/attr", "attr");
+ *   w.Commit();
+ *
+ * and opened by one mmap(). Finding a section is a probe of a hash
+ * table in the file, and a dictionary is used in place:
+ *
+ *   Container pack("dicts.pack");
+ *   const void *data = pack.Find("ja", &size);
+ *   Snapshot<int, unsigned char> ja(data, size, '\n', 0);
+ *
+ * The layout is a ContainerHeader, the sections (each aligned to
+ * MADA_CONTAINER_ALIGN bytes), the names (each ended with '\0') and the
+ * index, whose number of slots is a power of 2 and at least twice the
+ * number of sections.
+ */
+
+#ifndef _MADA_CONTAINER_HPP_
+#define _MADA_CONTAINER_HPP_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include "FileHeader.hpp"
+#include "DoubleArray.hpp"
+
+#define MADA_CONTAINER_MAGIC "MaDaCT\0\0"
+#define MADA_CONTAINER_ALIGN (64)
+
+namespace mada
+{
+struct ContainerHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endian; // MADA_ENDIAN_MARK in the byte order of the writer
+    uint32_t count; // the number of sections
+    uint32_t slots; // the number of slots of the index
+    int64_t index; // offset of the index
+    int64_t size; // size of the file
+    char reserved[24];
+};
+
+struct ContainerEntry
+{
+    uint64_t hash; // NameHash() of the name
+    int64_t name; // offset of the name, or 0 for an empty slot
+    int64_t offset; // offset of the section
+    int64_t size; // size of the section
+};
+
+/*
+ * 64-bit FNV-1a hash of a name.
+ */
+inline uint64_t NameHash(const char *name)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (; *name; name++) {
+	h ^= (unsigned char) *name;
+	h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+class Container
+{
+private:
+    void *map;
+    size_t map_size;
+    const ContainerHeader *header;
+    const ContainerEntry *index;
+
+    // Copy is forbidden.
+    Container(const Container &c);
+    Container &operator=(const Container &c);
+public:
+    Container(const char *filename);
+    ~Container();
+
+    const void *Find(const char *name, size_t *size) const;
+    void Names(std::vector<const char *> &names) const;
+    uint32_t Count() const { return header->count; }
+};
+
+/*
+ * Map the specified container file.
+ *
+ * Exceptions:
+ *   1: Failed to open the specified file.
+ *   2: The file is smaller than its header says.
+ *   3: Failed to map the file.
+ *   4: The header doesn't match (magic, version or byte order).
+ */
+inline Container::Container(const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) == -1)
+	throw 1;
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ContainerHeader)) {
+	close(fd);
+	throw 2;
+    }
+
+    map_size = st.st_size;
+    map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+	throw 3;
+
+    header = static_cast<const ContainerHeader *>(map);
+    if (memcmp(header->magic, MADA_CONTAINER_MAGIC, sizeof(header->magic)) ||
+	header->version != MADA_VERSION ||
+	header->endian != MADA_ENDIAN_MARK ||
+	header->slots == 0 || (header->slots & (header->slots - 1))) {
+	munmap(map, map_size);
+	throw 4;
+    }
+
+    if (header->size != (int64_t) map_size ||
+	header->index < (int64_t) sizeof(ContainerHeader) ||
+	(uint64_t) header->index + (uint64_t) header->slots *
+	sizeof(ContainerEntry) > map_size) {
+	munmap(map, map_size);
+	throw 2;
+    }
+
+    index = reinterpret_cast<const ContainerEntry *>(
+	static_cast<const char *>(map) + header->index);
+}
+
+inline Container::~Container()
+{
+    munmap(map, map_size);
+}
+
+/*
+ * Return the section named "name" and store its size to "*size", or
+ * return NULL if there is no such section. The section stays valid while
+ * this container is open.
+ */
+inline const void *Container::Find(const char *name, size_t *size) const
+{
+    const char *base = static_cast<const char *>(map);
+    uint64_t h = NameHash(name);
+    uint32_t mask = header->slots - 1;
+
+    for (uint32_t i = h & mask, n = 0; n <= mask; i = (i + 1) & mask, n++) {
+	const ContainerEntry &e = index[i];
+
+	if (e.name == 0)
+	    break;
+
+	if (e.hash != h || e.name >= header->index ||
+	    strncmp(base + e.name, name, header->index - e.name) != 0)
+	    continue;
+
+	if (e.offset < (int64_t) sizeof(ContainerHeader) || e.size < 0 ||
+	    e.offset + e.size > header->index)
+	    return NULL; // broken entry
+
+	*size = e.size;
+	return base + e.offset;
+    }
+
+    return NULL;
+}
+
+/*
+ * Store the names of all sections to "names", in the order of the
+ * index.
+ */
+inline void Container::Names(std::vector<const char *> &names) const
+{
+    const char *base = static_cast<const char *>(map);
+
+    names.clear();
+    for (uint32_t i = 0; i < header->slots; i++)
+	if (index[i].name > 0 && index[i].name < header->index)
+	    names.push_back(base + index[i].name);
+}
+
+class ContainerWriter
+{
+private:
+    std::vector<char> file;
+    std::vector<char> tmp;
+    FILE *f;
+    std::vector<ContainerEntry> entries; // "name" is an offset in "names"
+    std::vector<char> names;
+    int64_t offset; // the end of the last section
+
+    int Begin(const char *name);
+    int End();
+    int Fail();
+
+    // Copy is forbidden.
+    ContainerWriter(const ContainerWriter &w);
+    ContainerWriter &operator=(const ContainerWriter &w);
+public:
+    ContainerWriter(const char *filename);
+    ~ContainerWriter();
+
+    int Add(const char *name, const void *data, size_t size);
+    int AddFile(const char *name, const char *filename);
+    template <class IndexType, class KeyType>
+    int Add(const char *name, const DoubleArray<IndexType, KeyType> &da);
+    int Commit();
+};
+
+/*
+ * Start writing a container to "filename.tmp". Nothing is visible under
+ * "filename" until Commit().
+ *
+ * Exceptions:
+ *   1: Failed to create the temporary file.
+ */
+inline ContainerWriter::ContainerWriter(const char *filename) :
+    file(filename, filename + strlen(filename) + 1),
+    tmp(strlen(filename) + 5),
+    offset(sizeof(ContainerHeader))
+{
+    sprintf (&tmp[0], "%s.tmp", filename);
+
+    if (!(f = fopen (&tmp[0], "wb")))
+	throw 1;
+
+    // The header is written by Commit().
+    if (fseek (f, offset, SEEK_SET) != 0) {
+	fclose (f);
+	unlink (&tmp[0]);
+	throw 1;
+    }
+}
+
+/*
+ * A container which is not committed is removed.
+ */
+inline ContainerWriter::~ContainerWriter()
+{
+    Fail();
+}
+
+/*
+ * Give up the container after a failed write: the position of the file
+ * no longer matches the entries. Every later call returns -1, and
+ * nothing is created. It returns -1.
+ */
+inline int ContainerWriter::Fail()
+{
+    if (f) {
+	fclose (f);
+	unlink (&tmp[0]);
+	f = NULL;
+    }
+
+    return -1;
+}
+
+/*
+ * Check the name, and pad the file up to the next section. It returns 0
+ * on success, or -1 if the name is empty or already used (the writer can
+ * still be used), or writing fails (see Fail()).
+ */
+inline int ContainerWriter::Begin(const char *name)
+{
+    if (!f || !*name)
+	return -1;
+
+    uint64_t h = NameHash(name);
+    for (size_t i = 0; i < entries.size(); i++)
+	if (entries[i].hash == h && strcmp(&names[entries[i].name], name) == 0)
+	    return -1;
+
+    static const char zero[MADA_CONTAINER_ALIGN] = { 0 };
+    size_t pad = (MADA_CONTAINER_ALIGN - offset % MADA_CONTAINER_ALIGN)
+	% MADA_CONTAINER_ALIGN;
+
+    if (pad && fwrite (zero, 1, pad, f) != pad)
+	return Fail();
+    offset += pad;
+
+    ContainerEntry e;
+    e.hash = h;
+    e.name = names.size();
+    e.offset = offset;
+    e.size = 0;
+    entries.push_back(e);
+    names.insert(names.end(), name, name + strlen(name) + 1);
+
+    return 0;
+}
+
+/*
+ * Close the section started by Begin() at the current position of the
+ * file.
+ */
+inline int ContainerWriter::End()
+{
+    long end = ftell (f);
+
+    if (end < 0)
+	return Fail();
+
+    entries.back().size = end - entries.back().offset;
+    offset = end;
+
+    return 0;
+}
+
+/*
+ * Add a section of "size" bytes at "data". It returns 0 on success, or
+ * -1 on failure (see Begin() and Fail()). The same holds for the other
+ * Add methods.
+ */
+inline int ContainerWriter::Add(const char *name, const void *data,
+				size_t size)
+{
+    if (Begin(name) != 0)
+	return -1;
+
+    if (size && fwrite (data, 1, size, f) != size)
+	return Fail();
+
+    return End();
+}
+
+/*
+ * Add the whole content of "filename" as a section, e.g. a snapshot or
+ * the records of Attributes.
+ */
+inline int ContainerWriter::AddFile(const char *name, const char *filename)
+{
+    FILE *in;
+    char buf[65536];
+    size_t n;
+
+    // A missing file is found before anything is written.
+    if (!(in = fopen (filename, "rb")))
+	return -1;
+
+    if (Begin(name) != 0) {
+	fclose (in);
+	return -1;
+    }
+
+    while ((n = fread (buf, 1, sizeof(buf), in)) > 0) {
+	if (fwrite (buf, 1, n, f) != n) {
+	    fclose (in);
+	    return Fail();
+	}
+    }
+
+    if (ferror (in)) {
+	fclose (in);
+	return Fail();
+    }
+    fclose (in);
+
+    return End();
+}
+
+/*
+ * Add a snapshot of the double array, which can be opened in place by
+ * Snapshot(data, size, term, verify).
+ */
+template <class IndexType, class KeyType>
+int ContainerWriter::Add(const char *name,
+			 const DoubleArray<IndexType, KeyType> &da)
+{
+    if (Begin(name) != 0)
+	return -1;
+
+    if (da.WriteSnapshot(f) != 0)
+	return Fail();
+
+    return End();
+}
+
+/*
+ * Write the names, the index and the header, and rename the file. No
+ * section can be added after this. It returns 0 on success, or -1 on
+ * failure, in which case the file is not created.
+ */
+inline int ContainerWriter::Commit()
+{
+    if (!f)
+	return -1;
+
+    uint32_t slots = 2;
+    while (slots < 2 * entries.size())
+	slots *= 2;
+
+    // Names follow the sections, and the index follows the names.
+    int64_t names_offset = offset;
+    int64_t index_offset = names_offset + names.size();
+    index_offset += (8 - index_offset % 8) % 8;
+
+    std::vector<ContainerEntry> index(slots);
+    memset(&index[0], 0, slots * sizeof(ContainerEntry));
+    for (size_t i = 0; i < entries.size(); i++) {
+	uint32_t j = entries[i].hash & (slots - 1);
+
+	while (index[j].name != 0)
+	    j = (j + 1) & (slots - 1);
+
+	index[j] = entries[i];
+	index[j].name += names_offset;
+    }
+
+    ContainerHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MADA_CONTAINER_MAGIC, sizeof(h.magic));
+    h.version = MADA_VERSION;
+    h.endian = MADA_ENDIAN_MARK;
+    h.count = entries.size();
+    h.slots = slots;
+    h.index = index_offset;
+    h.size = index_offset + slots * sizeof(ContainerEntry);
+
+    static const char zero[8] = { 0 };
+    size_t pad = index_offset - names_offset - names.size();
+    int failed =
+	(!names.empty() &&
+	 fwrite (&names[0], 1, names.size(), f) != names.size()) ||
+	(pad && fwrite (zero, 1, pad, f) != pad) ||
+	fwrite (&index[0], sizeof(ContainerEntry), slots, f) != slots ||
+	fseek (f, 0, SEEK_SET) != 0 ||
+	fwrite (&h, sizeof(h), 1, f) != 1 ||
+	fflush (f) != 0 ||
+	fsync (fileno (f)) != 0;
+
+    failed = fclose (f) != 0 || failed;
+    f = NULL;
+
+    if (failed || rename (&tmp[0], &file[0]) != 0) {
+	unlink (&tmp[0]);
+	return -1;
+    }
+
+    return 0;
+}
+
+}
+
+#endif // _MADA_CONTAINER_HPP_
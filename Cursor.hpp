@@ -0,0 +1,249 @@
+/*
+ * Cursor.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cursor over the keys of a DoubleArray in lexicographic order.
+ *
+ * A key comes before the other keys which have it as a prefix, i.e. the
+ * terminal symbol is treated as the smallest label. The cursor keeps one
+ * frame (node and the next label to visit) for each depth and the labels
+ * of the current key, so that stepping to the next key doesn't allocate
+ * memory once these buffers have grown to the depth of the trie.
+ *
+ * Usage:
+ *   Cursor<int, unsigned char> c(da);
+ *   for (int ok = c.Range(lo, hi); ok; ok = c.Next())
+ *       ... c.Key(), c.Length(), c.Index() ...
+ *
+ * The double array must not be updated while a cursor is in use.
+ */
+
+#ifndef _MADA_CURSOR_HPP_
+#define _MADA_CURSOR_HPP_
+
+#include <vector>
+#include "DoubleArray.hpp"
+
+namespace mada
+{
+template <class IndexType, class KeyType> class Cursor
+{
+private:
+    struct Frame
+    {
+	IndexType node;
+	IndexType next; // the order of the next child to visit
+    };
+
+    const DoubleArray<IndexType, KeyType> &da;
+    vector<Frame> stack;
+    vector<KeyType> key;
+    IndexType leaf; // the leaf node of the current key (0 if none)
+    const KeyType *hi; // upper bound (exclusive) or NULL
+
+    IndexType Child(IndexType s, IndexType *order);
+    void Push(IndexType s, KeyType c);
+    int Bound();
+public:
+    Cursor(const DoubleArray<IndexType, KeyType> &da);
+
+    int Begin();
+    int Seek(const KeyType *a);
+    int Range(const KeyType *lo, const KeyType *hi);
+    int Next();
+
+    const KeyType *Key() { return &key[0]; }
+    size_t Length() { return stack.size() - 1; }
+    IndexType Index() { return leaf; }
+};
+
+template <class IndexType, class KeyType>
+Cursor<IndexType, KeyType>::Cursor(const DoubleArray<IndexType, KeyType> &da) :
+    da(da),
+    leaf(0),
+    hi(NULL)
+{
+}
+
+/*
+ * Find the first child of "s" whose order is "*order" or greater, where
+ * the order of the terminal symbol is 0 and that of the other labels is
+ * the label itself. The order of the found child is stored to "*order",
+ * and its index is returned (0 if there is no such child).
+ */
+template <class IndexType, class KeyType>
+inline IndexType Cursor<IndexType, KeyType>::Child(IndexType s,
+						   IndexType *order)
+{
+    if (da.base[s] <= 0)
+	return 0;
+
+    if (*order == 0) {
+	IndexType t = da.Forward(s, da.term);
+	if (t)
+	    return t;
+	*order = 1;
+    }
+
+    IndexType b = da.base[s];
+    IndexType last = b + da.max;
+
+    if (last > da.Header()->da_size)
+	last = da.Header()->da_size;
+
+    for (IndexType t = b + *order; t <= last; t++) {
+	if (da.check[t] == s && t - b != da.term) {
+	    *order = t - b;
+	    return t;
+	}
+    }
+
+    return 0;
+}
+
+template <class IndexType, class KeyType>
+inline void Cursor<IndexType, KeyType>::Push(IndexType s, KeyType c)
+{
+    size_t d = stack.size();
+    Frame f = { s, 0 };
+
+    stack.push_back(f);
+    if (key.size() <= d)
+	key.resize(d+1);
+    key[d-1] = c;
+}
+
+/*
+ * Invalidate the cursor if the current key is not less than the upper
+ * bound. It returns 1 if the cursor is still valid.
+ */
+template <class IndexType, class KeyType>
+inline int Cursor<IndexType, KeyType>::Bound()
+{
+    if (leaf && hi &&
+	!typename DoubleArray<IndexType, KeyType>::KeyLess(da.term)(&key[0], hi))
+	leaf = 0;
+
+    return leaf != 0;
+}
+
+/*
+ * Move to the first key. It returns 0 if there is no key.
+ */
+template <class IndexType, class KeyType>
+int Cursor<IndexType, KeyType>::Begin()
+{
+    return Range(NULL, NULL);
+}
+
+/*
+ * Move to the first key which is not less than "a" (lower bound). It
+ * returns 0 if there is no such key. Any upper bound set by Range() is
+ * kept.
+ *
+ * Argument:
+ *   a: Key to be searched.
+ *      The end of this string must be ended with terminal symbol "term".
+ */
+template <class IndexType, class KeyType>
+int Cursor<IndexType, KeyType>::Seek(const KeyType *a)
+{
+    Frame root = { 1, 0 };
+
+    stack.clear();
+    stack.push_back(root);
+    key.resize(1);
+    leaf = 0;
+
+    for (size_t d = 0; a; d++) {
+	KeyType c = a[d];
+	IndexType order = c == da.term ? 0 : c;
+	IndexType t = da.Forward(stack.back().node, c);
+
+	if (t == 0) {
+	    // Every following child of this node is greater than "a".
+	    stack.back().next = order;
+	    break;
+	}
+
+	stack.back().next = order + 1;
+
+	if (c == da.term) {
+	    key[d] = c;
+	    leaf = t;
+	    return Bound();
+	}
+
+	Push(t, c);
+    }
+
+    return Next();
+}
+
+/*
+ * Move to the first key in [lo, hi). Next() stops before "hi". Either of
+ * "lo" or "hi" can be NULL for no bound. "hi" must stay valid while the
+ * cursor is used.
+ */
+template <class IndexType, class KeyType>
+int Cursor<IndexType, KeyType>::Range(const KeyType *lo, const KeyType *hi)
+{
+    this->hi = hi;
+
+    return Seek(lo);
+}
+
+/*
+ * Move to the next key. It returns 0 if there is no more key.
+ */
+template <class IndexType, class KeyType>
+int Cursor<IndexType, KeyType>::Next()
+{
+    leaf = 0;
+
+    while (!stack.empty() && da.Header()->num_key) {
+	Frame &f = stack.back();
+	IndexType order = f.next;
+	IndexType t = Child(f.node, &order);
+
+	if (t == 0) {
+	    stack.pop_back();
+	    continue;
+	}
+
+	f.next = order + 1;
+
+	if (order == 0) {
+	    key[stack.size()-1] = da.term;
+	    leaf = t;
+	    return Bound();
+	}
+
+	Push(t, order);
+    }
+
+    stack.clear();
+    return 0;
+}
+
+}
+
+#endif // _MADA_CURSOR_HPP_
@@ -26,6 +26,14 @@
  * Warning:
  *  IndexType must be signed value.
  *  KeyType must be unsigned value.
+ *
+ *  A double array with more than 2^31 cells needs a 64-bit IndexType
+ *  (e.g. long long). See CompactDoubleArray for a 4-byte cell encoding.
+ *
+ *  const methods (Search(), SearchId(), Key(), FuzzySearch(), ...) only
+ *  read the arrays and keep their work space on the stack, so that any
+ *  number of threads may call them at the same time. Updates need
+ *  exclusive access.
  */
 
 #ifndef _MADA_DOUBLE_ARRAY_HPP_
@@ -33,18 +41,43 @@
 
 #include <vector>
 #include <list>
+#include <algorithm>
+#include <queue>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
 #include "MappedArray.hpp"
 #include "KeySet.hpp"
+#include "MappedWordList.hpp"
+#include "FileHeader.hpp"
+#include "CheckScan.hpp"
 
-#define DA_SIZE (check[0])
-#define NUM_KEY (base[0])
+#define DA_SIZE (Header()->da_size)
+#define NUM_KEY (Header()->num_key)
+#define ID_LIMIT (Header()->id_limit)
+
+#define MADA_MAX_LANES (32) // lookups in flight in SearchBatch()
 
 using namespace std;
 
 namespace mada
 {
+template <class KeyType> class CompactDoubleArray;
+template <class IndexType, class KeyType> class AhoCorasick;
+template <class IndexType, class KeyType> class Cursor;
+template <class IndexType, class KeyType, class T> class Attributes;
+template <class IndexType, class KeyType> class KeyFilter;
+template <class KeyType> class LoudsTrie;
+
 template <class IndexType, class KeyType> class DoubleArray
 {
+    friend class CompactDoubleArray<KeyType>;
+    friend class AhoCorasick<IndexType, KeyType>;
+    friend class Cursor<IndexType, KeyType>;
+    template <class I, class K, class T> friend class Attributes;
+    template <class I, class K> friend class KeyFilter;
+    friend class LoudsTrie<KeyType>;
+
 private:
     MappedArray<IndexType> base;
     MappedArray<IndexType> check;
@@ -57,17 +90,115 @@ private:
 
     KeySet<KeyType> R;
 
-    int keylen(const KeyType *key);
+    // Ids below ID_LIMIT which are not used by any key. This is valid
+    // only if "free_ids_valid" is not 0. Otherwise it is made by a scan
+    // of the leaves when a new id is needed.
+    vector<IndexType> free_ids;
+    int free_ids_valid;
+
+    FileHeader *Header() { return static_cast<FileHeader *>(base.header()); }
+    const FileHeader *Header() const
+    { return static_cast<const FileHeader *>(base.header()); }
+    FileHeader *HeaderOfCheck() { return static_cast<FileHeader *>(check.header()); }
+    void Clear();
+
+    int keylen(const KeyType *key) const;
     void W_Base(IndexType index, IndexType val);
     void W_Check(IndexType index, IndexType val);
     IndexType X_Check(KeySet<KeyType> &A);
-    int Forward(IndexType s, KeyType a);
+    bool X_Fits(KeySet<KeyType> &A, IndexType q);
+    IndexType Forward(IndexType s, KeyType a) const;
     void GetLabel(IndexType index);
-    void Modify(IndexType index, KeyType b);
-    void Insert(IndexType index, IndexType pos, const KeyType *a);
+    size_t GetChildren(IndexType index, KeyType *labels) const;
+    void Modify(IndexType index, size_t n);
+    IndexType Insert(IndexType index, IndexType pos, const KeyType *a);
     void Delete(IndexType index);
+    IndexType NewId();
+    void FreeId(IndexType id);
 
     void ConstructUnusedList();
+    void Depths(vector<int> &depth) const;
+
+    // for Build()
+    struct KeyLess
+    {
+	KeyType term;
+
+	KeyLess(KeyType term) : term(term) {}
+	bool operator()(const KeyType *a, const KeyType *b) const;
+    };
+
+    struct Shard
+    {
+	size_t begin, end; // range of keys which share the first label
+	KeyType label; // the first label
+	IndexType offset; // the position of this shard in the double array
+	vector<IndexType> base;
+	vector<IndexType> check;
+	vector<char> used;
+    };
+
+    struct BuildNode
+    {
+	IndexType index;
+	size_t begin, end; // range of keys under this node
+	size_t depth;
+	int fresh; // this node is created by AddBatch()
+    };
+
+    void SortKeys(vector<const KeyType *> &keys);
+
+    struct BuildContext
+    {
+	const KeyType * const *keys;
+	vector<Shard> *shards;
+	vector<size_t> order;
+	size_t next;
+	pthread_mutex_t lock;
+	KeyType term;
+    };
+
+    static IndexType FindFree(vector<IndexType> &next_free, IndexType index);
+    static void BuildShard(const KeyType * const *keys, Shard &sh,
+			   KeyType term);
+    static void *BuildWorker(void *arg);
+
+    // for Relayout()
+    struct RelayoutNode
+    {
+	IndexType from; // index in the current arrays
+	IndexType to; // index in the new arrays
+	unsigned long long hits;
+	size_t seq; // the order of pushing
+
+	bool operator<(const RelayoutNode &n) const
+	{ return hits < n.hits || (hits == n.hits && seq < n.seq); }
+    };
+
+    IndexType RelayoutByHits(const vector<unsigned long long> &hits);
+    static IndexType Place(const KeyType *labels, size_t count,
+			   IndexType parent,
+			   vector<IndexType> &nb, vector<IndexType> &nc,
+			   vector<char> &used, vector<IndexType> &next_free);
+    IndexType Install(const vector<IndexType> &nb,
+		      const vector<IndexType> &nc);
+
+    // for SearchBatch()
+    struct Lookup
+    {
+	const KeyType *a; // the symbol to be read next
+	IndexType s; // the current node
+	IndexType t; // the cell of the next node, prefetched
+	size_t i; // the number of the key
+    };
+
+    // for Merge()
+    struct MergeNode
+    {
+	IndexType a; // index in this double array (0 if none)
+	IndexType b; // index in the other double array (0 if none)
+	IndexType to; // index in the new arrays
+    };
 public:
     DoubleArray(const char *basefile,
 		const char *checkfile,
@@ -76,42 +207,121 @@ public:
 		int initialize);
     ~DoubleArray();
 
-    IndexType Search(const KeyType *a);
+    IndexType Search(const KeyType *a) const;
+    size_t SearchBatch(const KeyType * const *keys, size_t n,
+		       IndexType *results, size_t width) const;
     IndexType Add(const KeyType *a);
+    IndexType Add(const KeyType *a, IndexType *id);
     IndexType Remove(const KeyType *a);
+    IndexType Id(IndexType index) const;
+    IndexType SearchId(const KeyType *a) const;
+    int Key(IndexType index, KeyType *buf, size_t size) const;
+    void GetLeaves(vector<IndexType> &leaves) const;
+    IndexType IdLimit() const { return ID_LIMIT; }
+    IndexType NumKey() const { return NUM_KEY; }
+    IndexType AddBatch(vector<const KeyType *> &keys);
+
+    template <class Callback>
+    size_t PrefixSearch(const KeyType *a, Callback &callback) const;
+    template <class Callback>
+    size_t FuzzySearch(const KeyType *a, int k, Callback &callback) const;
+    template <class Callback>
+    size_t Segment(const KeyType *text, size_t len, Callback &callback) const;
+    template <class Callback>
+    size_t PatternSearch(const KeyType *pattern, size_t limit,
+			 Callback &callback) const;
+
+    IndexType Build(vector<const KeyType *> &keys, int threads);
+    IndexType Relayout();
+    IndexType RelayoutByProfile(const char *file);
+    template <class Callback>
+    IndexType Merge(const DoubleArray &other, Callback &callback);
 
     int loadWordList(const char *file);
-    void dump();
-    void printInfo();
+    int loadSortedWordList(const char *file, int threads);
+    int WriteSnapshot(const char *file) const;
+    int WriteSnapshot(FILE *f) const;
+    void dump() const;
+    void printInfo() const;
+    void printMemory() const;
+    size_t WarmUp(int depth) const;
+    size_t Verify(int verbose) const;
+
+    // for benchmarks of X_Check()
+    void LabelSets(vector<KeyType> &labels, vector<size_t> &offsets,
+		   size_t min) const;
+    IndexType FindBase(const KeyType *labels, size_t n, int linear);
 };
 
+/*
+ * Open the double array in "basefile" and "checkfile". Both files begin
+ * with a FileHeader, which is validated without reading the arrays. If
+ * "initialize" is not 0, or both files are new, an empty double array is
+ * created.
+ *
+ * If the files were closed properly, the head of the unused element list
+ * is restored from the header, so that ConstructUnusedList() is skipped.
+ *
+ * Exceptions:
+ *   1: The terminal symbol is not greater than 0.
+ *   2: The header of "basefile" doesn't match the parameters (magic,
+ *      version, byte order, IndexType, KeyType, terminal symbol or max).
+ *   3: "checkfile" doesn't match "basefile".
+ *   7: The size or the head of the unused element list in the header
+ *      doesn't fit in the files (e.g. a file was truncated).
+ *   Others: See MappedArray.
+ */
 template <class IndexType, class KeyType>
 DoubleArray<IndexType, KeyType>::DoubleArray(const char *basefile,
 					     const char *checkfile,
 					     KeyType term,
 					     KeyType max,
 					     int initialize) :
-    base(basefile),
-    check(checkfile),
+    base(basefile, sizeof(FileHeader)),
+    check(checkfile, sizeof(FileHeader)),
     R(max)
 {
-    if (initialize)
-    {
-	base.clear();
-	NUM_KEY = 0; /* base[0] is used for the number of keys */
-	base[1] = 1;
-
-	check.clear();
-	DA_SIZE = 1; /* check[0] is used for the size of double array. */
-	check[1] = 0;
-    }
-
     if (term <= 0)
 	throw 1; /* terminal symbol must be greater than 0. */
 
     this->term = term;
     this->max = max;
     this->e_head = 0;
+
+    if (!initialize && Header()->magic[0] == 0 && HeaderOfCheck()->magic[0] == 0)
+	initialize = 1; // new files
+
+    if (initialize)
+    {
+	Clear();
+    } else {
+	if (!mada::CheckHeader<IndexType, KeyType>(Header(), term) ||
+	    Header()->max != (uint32_t) max)
+	    throw 2;
+
+	if (memcmp(HeaderOfCheck(), Header(), offsetof(FileHeader, checksum)) ||
+	    HeaderOfCheck()->pair != Header()->pair)
+	    throw 3;
+
+	// Every cell up to DA_SIZE must be mapped, as in Snapshot::Attach().
+	if (DA_SIZE < 1 || (size_t) DA_SIZE + 1 > base.size() ||
+	    (size_t) DA_SIZE + 1 > check.size())
+	    throw 7;
+
+	// fast open
+	if (Header()->flags & MADA_FLAG_CLEAN) {
+	    e_head = Header()->e_head;
+
+	    if (e_head && (e_head < 1 || e_head > DA_SIZE + 1))
+		throw 7;
+	}
+
+	// no freed id
+	free_ids_valid = ID_LIMIT == NUM_KEY;
+    }
+
+    // The unused element list in the file is updated from now on.
+    Header()->flags &= ~MADA_FLAG_CLEAN;
 }
 
 template <class IndexType, class KeyType>
@@ -119,10 +329,45 @@ DoubleArray<IndexType, KeyType>::~DoubleArray()
 {
     base.truncate(DA_SIZE+1);
     check.truncate(DA_SIZE+1);
+
+    Header()->e_head = e_head;
+    Header()->flags |= MADA_FLAG_CLEAN;
+    memcpy(HeaderOfCheck(), Header(), sizeof(FileHeader));
+}
+
+/*
+ * Make this double array empty, and write new headers to both files.
+ * "pair" is new, and "serial" is increased.
+ */
+template <class IndexType, class KeyType>
+void DoubleArray<IndexType, KeyType>::Clear()
+{
+    // "serial" goes on from the old header, so that files made for the
+    // old keys (e.g. KeyFilter) never match the new ones.
+    uint64_t serial = memcmp(Header()->magic, MADA_MAGIC,
+			     sizeof(Header()->magic)) ? 0 : Header()->serial;
+
+    base.clear();
+    check.clear();
+
+    InitHeader<IndexType, KeyType>(Header(), term, max);
+    Header()->pair = NewPair();
+    Header()->serial = serial + 1;
+    memcpy(HeaderOfCheck(), Header(), sizeof(FileHeader));
+
+    NUM_KEY = 0;
+    DA_SIZE = 1;
+    ID_LIMIT = 0;
+    base[1] = 1;
+    check[1] = 0;
+    e_head = 0;
+
+    free_ids.clear();
+    free_ids_valid = 1;
 }
 
 template <class IndexType, class KeyType>
-int DoubleArray<IndexType, KeyType>::keylen(const KeyType *a)
+int DoubleArray<IndexType, KeyType>::keylen(const KeyType *a) const
 {
     int i = 0;
 
@@ -252,12 +497,17 @@ inline void DoubleArray<IndexType, KeyType>::W_Check(IndexType index, IndexType
 template <class IndexType, class KeyType>
 inline IndexType DoubleArray<IndexType, KeyType>::X_Check(KeySet<KeyType> &A)
 {
+    // smallest and largest label
+    KeyType c1 = A[0], cn = A[0];
+    for (size_t i=0; i<A.size(); i++) {
+	if (A[i] < c1)
+	    c1 = A[i];
+	if (A[i] > cn)
+	    cn = A[i];
+    }
+
     if (e_head) {
 	// unused element list
-	KeyType c1 = A[0];
-	for (int i=0; i<A.size(); i++)
-	    if (A[i] < c1)
-		c1 = A[i];
 
 	// (XX-1)
 	IndexType e_index = e_head;
@@ -265,25 +515,28 @@ inline IndexType DoubleArray<IndexType, KeyType>::X_Check(KeySet<KeyType> &A)
 	// (XX-2)
 	do {
 	    IndexType q = e_index - c1;
-
-	    if (q >= 1) {
-		int ok = 1;
-		for (size_t i = 0; i<A.size(); i++) {
-		    KeyType c = A[i];
-
-		    if (q+c <= DA_SIZE && check[q+c] > 0) {
-			ok = 0;
-			break;
-		    }
-		}
-
-		if (ok) {
-//		    printf ("q (1) = %d\n", q);
-		    return q;
-		}
+	    IndexType next = -check[e_index];
+
+	    // When the next unused cell is close, candidates q, q+1, ...,
+	    // q+7 are tested at once by BusyMask8(). The list is in
+	    // ascending order, and base q+j can fit only if e_index+j is
+	    // unused, so the lowest idle candidate is the one the list would
+	    // reach first. Sparse cells are tested one at a time, where the
+	    // first used cell ends the test.
+	    if (q >= 1 && next < e_index + 8 && q + cn + 7 <= DA_SIZE) {
+		unsigned int busy = BusyMask8(&check[q], &A[0], A.size());
+
+		if (busy != MADA_BUSY_ALL)
+		    return q + FirstIdle8(busy);
+
+		while (next < e_index + 8 && next <= DA_SIZE)
+		    next = -check[next];
+	    } else if (q >= 1 && X_Fits(A, q)) {
+//		printf ("q (1) = %d\n", q);
+		return q;
 	    }
 
-	    e_index = -check[e_index];
+	    e_index = next;
 	} while (e_index <= DA_SIZE); // (XX-3)
 
 //	printf ("q (2) = %d, e_index = %d\n", e_index-c1, e_index);
@@ -293,32 +546,32 @@ inline IndexType DoubleArray<IndexType, KeyType>::X_Check(KeySet<KeyType> &A)
 	    return e_index - c1;
     } else {
 	IndexType q;
-	KeyType c;
 
 	// X-1
 	q = 1;
 
 	// X-2
-	do {
-	    int ok = 1;
+	// Candidates q, q+1, ..., q+7 are tested at once by BusyMask8() as
+	// long as check[q+cn+7] is inside the array. Near the end of the
+	// array one candidate is tested at a time.
+	while (q + cn + 7 <= DA_SIZE) {
+	    unsigned int busy = BusyMask8(&check[q], &A[0], A.size());
 
-	    for (size_t i = 0; i<A.size(); i++) {
-		KeyType c = A[i];
+	    if (busy != MADA_BUSY_ALL)
+		return q + FirstIdle8(busy);
 
-		if (q+c <= DA_SIZE && check[q+c] > 0) {
-		    ok = 0;
-		    break;
-		}
-	    }
+	    q += 8;
+	}
 
+	while (q <= DA_SIZE) {
 	    // this q meets the condition that check[q+c]=0 for all c in A.
-	    if (ok) {
+	    if (X_Fits(A, q)) {
 //		printf ("q (3) = %d\n", q);
 		return q;
 	    }
 
 	    q++;
-	} while (q <= DA_SIZE);
+	}
 
 	// (X-3)
 //	printf ("q (4) = %d\n", q);
@@ -327,7 +580,21 @@ inline IndexType DoubleArray<IndexType, KeyType>::X_Check(KeySet<KeyType> &A)
 }
 
 template <class IndexType, class KeyType>
-int DoubleArray<IndexType, KeyType>::Forward(IndexType s, KeyType a)
+inline bool DoubleArray<IndexType, KeyType>::X_Fits(KeySet<KeyType> &A,
+						    IndexType q)
+{
+    for (size_t i = 0; i<A.size(); i++) {
+	KeyType c = A[i];
+
+	if (q+c <= DA_SIZE && check[q+c] > 0)
+	    return false;
+    }
+
+    return true;
+}
+
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::Forward(IndexType s, KeyType a) const
 {
     IndexType t;
 
@@ -365,25 +632,58 @@ inline void DoubleArray<IndexType, KeyType>::GetLabel(IndexType index)
     }
 }
 
+/*
+ * Store the labels of all children of the specified node to "labels" in
+ * ascending order, and return the number of children. "labels" must have
+ * room for "max" labels.
+ *
+ * Unlike GetLabel(), this method doesn't touch R, and the range of the
+ * scan is clipped to the array before the loop, so that the loop is a
+ * plain comparison of consecutive CHECK values.
+ */
+template <class IndexType, class KeyType>
+inline size_t DoubleArray<IndexType, KeyType>::GetChildren(IndexType index,
+							   KeyType *labels) const
+{
+    if (index <= 0 || base[index] <= 0)
+	return 0;
+
+    IndexType b = base[index];
+    IndexType last = b + max;
+    size_t n = 0;
+
+    if (last > DA_SIZE)
+	last = DA_SIZE;
+
+    IndexType t = b + 1;
+    for (; t + 7 <= last; t += 8) {
+	unsigned int equal = EqualMask8(&check[t], index);
+
+	for (int j = 0; equal; j++, equal >>= 1)
+	    if (equal & 1)
+		labels[n++] = t + j - b;
+    }
+    for (; t <= last; t++)
+	if (check[t] == index)
+	    labels[n++] = t - b;
+
+    return n;
+}
+
 template <class IndexType, class KeyType>
-inline void DoubleArray<IndexType, KeyType>::Modify(IndexType index, KeyType b)
+inline void DoubleArray<IndexType, KeyType>::Modify(IndexType index, size_t n)
 {
     IndexType t, old_t, q;
 
     // (M-1)
+    // R holds the labels of the "n" existing children followed by the
+    // labels of new children, so that one relocation makes room for all.
     IndexType oldbase = base[index];
 
-/*
-    list<KeyType> tmp = R;
-    tmp.push_back (b);
-    W_Base (index, X_Check (tmp));
-*/
-    R.push_back (b);
     W_Base (index, X_Check (R));
-    R.pop_back ();
 
     // (M-2)
-    for (size_t i = 0; i<R.size(); i++) {
+    for (size_t i = 0; i<n; i++) {
 	KeyType c = R[i];
 
 	t = base[index] + c;
@@ -406,8 +706,12 @@ inline void DoubleArray<IndexType, KeyType>::Modify(IndexType index, KeyType b)
     }
 }
 
+/*
+ * Add the rest of "a" from "pos" under the node "index", and return the
+ * new leaf.
+ */
 template <class IndexType, class KeyType>
-void DoubleArray<IndexType, KeyType>::Insert(IndexType index, IndexType pos, const KeyType *a)
+IndexType DoubleArray<IndexType, KeyType>::Insert(IndexType index, IndexType pos, const KeyType *a)
 {
     int n = keylen (a);
     IndexType t = base[index] + a[pos-1];
@@ -415,7 +719,8 @@ void DoubleArray<IndexType, KeyType>::Insert(IndexType index, IndexType pos, con
     // (I-1)
     if (t <= DA_SIZE && check[t] > 0) {
 	GetLabel (index);
-	Modify (index, a[pos-1]);
+	R.push_back (a[pos-1]);
+	Modify (index, R.size()-1);
 
 	t = base[index] + a[pos-1];
     }
@@ -439,7 +744,9 @@ void DoubleArray<IndexType, KeyType>::Insert(IndexType index, IndexType pos, con
 	pos++;
     }
 
-    W_Base (t, -1); // ToDo: Change -1 according to the record.
+    W_Base (t, -(NewId() + 1));
+
+    return t;
 }
 
 template <class IndexType, class KeyType>
@@ -449,6 +756,48 @@ void DoubleArray<IndexType, KeyType>::Delete(IndexType index)
     W_Check (index, 0);
 }
 
+/*
+ * Return an id for a new key. A freed id is reused if any, so that ids
+ * stay below the largest number of keys ever held.
+ *
+ * A leaf holds the id of its key as -(id + 1) in the BASE array.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::NewId()
+{
+    if (!free_ids_valid) {
+	// Find ids freed before this double array was opened.
+	vector<char> used(ID_LIMIT, 0);
+
+	for (IndexType i = 1; i <= DA_SIZE; i++)
+	    if (check[i] > 0 && base[i] < 0)
+		used[-base[i] - 1] = 1;
+
+	free_ids.clear();
+	for (IndexType id = ID_LIMIT; id-- > 0; )
+	    if (!used[id])
+		free_ids.push_back(id); // the smallest id is the last
+
+	free_ids_valid = 1;
+    }
+
+    if (!free_ids.empty()) {
+	IndexType id = free_ids.back();
+	free_ids.pop_back();
+	return id;
+    }
+
+    ID_LIMIT = ID_LIMIT + 1;
+    return ID_LIMIT - 1;
+}
+
+template <class IndexType, class KeyType>
+void DoubleArray<IndexType, KeyType>::FreeId(IndexType id)
+{
+    if (free_ids_valid)
+	free_ids.push_back(id);
+}
+
 template <class IndexType, class KeyType>
 void DoubleArray<IndexType, KeyType>::ConstructUnusedList()
 {
@@ -480,7 +829,7 @@ void DoubleArray<IndexType, KeyType>::ConstructUnusedList()
  *      The end of this string must be ended with terminal symbol "term".
  */
 template <class IndexType, class KeyType>
-IndexType DoubleArray<IndexType, KeyType>::Search(const KeyType *a)
+IndexType DoubleArray<IndexType, KeyType>::Search(const KeyType *a) const
 {
     if (!NUM_KEY)
 	return 0;
@@ -504,6 +853,93 @@ IndexType DoubleArray<IndexType, KeyType>::Search(const KeyType *a)
     return index;
 }
 
+/*
+ * Search "n" keys, and store the result of Search() for keys[i] to
+ * results[i]. The return value is the number of keys found.
+ *
+ * Up to "width" lookups (at most MADA_MAX_LANES) are in flight at once.
+ * Each step of a lookup checks the cell prefetched by its previous step,
+ * prefetches the cells of the next node and passes the turn to the next
+ * lookup, so that the cache misses of different keys overlap. A finished
+ * lookup is replaced by the next key. This pays off when the arrays are
+ * much larger than the cache; with a width of 1 it is a plain Search().
+ */
+template <class IndexType, class KeyType>
+size_t DoubleArray<IndexType, KeyType>::SearchBatch(const KeyType * const *keys,
+						    size_t n,
+						    IndexType *results,
+						    size_t width) const
+{
+    size_t found = 0;
+
+    if (!NUM_KEY || width <= 1) {
+	for (size_t i = 0; i < n; i++)
+	    found += (results[i] = Search(keys[i])) != 0;
+	return found;
+    }
+
+    if (width > MADA_MAX_LANES)
+	width = MADA_MAX_LANES;
+
+    // Stores to "results" may alias the header and the arrays, so they
+    // are read once here.
+    const IndexType *b = &base[0];
+    const IndexType *c = &check[0];
+    const IndexType size = DA_SIZE;
+    const IndexType root = b[1];
+
+    Lookup lanes[MADA_MAX_LANES];
+    size_t active = 0, next = 0;
+
+    // start the first lookups
+    for (; active < width && next < n; active++, next++) {
+	Lookup &l = lanes[active];
+
+	l.a = keys[next];
+	l.i = next;
+	l.s = 1;
+	l.t = root + *l.a;
+	__builtin_prefetch(&c[l.t]);
+    }
+
+    while (active > 0) {
+	for (size_t j = 0; j < active; j++) {
+	    Lookup &l = lanes[j];
+	    IndexType result;
+
+	    // the same step as Forward() in Search()
+	    if (l.t <= 0 || l.t > size || c[l.t] != l.s)
+		result = 0;
+	    else if (b[l.t] < 0)
+		result = l.t;
+	    else {
+		l.s = l.t;
+		l.t = b[l.s] + *++l.a;
+		__builtin_prefetch(&c[l.t]);
+		__builtin_prefetch(&b[l.t]);
+		continue;
+	    }
+
+	    results[l.i] = result;
+	    found += result != 0;
+
+	    if (next < n) {
+		l.a = keys[next];
+		l.i = next++;
+		l.s = 1;
+		l.t = root + *l.a;
+		__builtin_prefetch(&c[l.t]);
+	    } else {
+		// The last lookup takes this lane, and is run in this round.
+		l = lanes[--active];
+		j--;
+	    }
+	}
+    }
+
+    return found;
+}
+
 /*
  * This method inserts a new key to this double array. If it successfully
  * adds the specified key, it returns 1. Otherwise, it returns 0.
@@ -514,6 +950,17 @@ IndexType DoubleArray<IndexType, KeyType>::Search(const KeyType *a)
  */
 template <class IndexType, class KeyType>
 IndexType DoubleArray<IndexType, KeyType>::Add(const KeyType *a)
+{
+    return Add(a, NULL);
+}
+
+/*
+ * Same as Add(const KeyType *a), but the id of the key is stored to "id"
+ * whether the key is new or not, unless "id" is NULL.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::Add(const KeyType *a,
+					       IndexType *id)
 {
     // (D-1)
     IndexType index = 1;
@@ -524,12 +971,15 @@ IndexType DoubleArray<IndexType, KeyType>::Add(const KeyType *a)
 	// (D-2)
 	t = Forward (index, a[pos-1]);
 	if (t == 0) {
-	    Insert (index, pos, a);
+	    index = Insert (index, pos, a);
 
 	    if (e_head == 0)
 		ConstructUnusedList ();
 
 	    NUM_KEY = NUM_KEY + 1;
+	    Header()->serial++;
+	    if (id)
+		*id = Id(index);
 	    return 1;
 	} else {
 	    index = t;
@@ -537,9 +987,120 @@ IndexType DoubleArray<IndexType, KeyType>::Add(const KeyType *a)
 	}
     } while (base[index] >= 0); // (D-3)
 
+    if (id)
+	*id = Id(index);
     return 0;
 }
 
+/*
+ * This method inserts many keys at once, and returns the number of newly
+ * added keys.
+ *
+ * The keys are sorted and grouped by the node where they leave the trie.
+ * For each such node, the labels of all existing and new children are
+ * passed to X_Check() at once, so that a node is relocated by Modify() at
+ * most once per batch. A subtree made only of new keys is placed node by
+ * node with all labels of each node.
+ *
+ * Argument:
+ *   keys: Keys to be added. Each key must be ended with terminal symbol
+ *         "term". This vector is sorted and duplicated keys are removed.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::AddBatch(vector<const KeyType *> &keys)
+{
+    vector<BuildNode> stack;
+    vector<KeyType> labels;
+    vector<size_t> bounds;
+    vector<char> added;
+    IndexType count = 0;
+
+    SortKeys(keys);
+    if (keys.empty())
+	return 0;
+
+    BuildNode root = { 1, 0, keys.size(), 0, 0 };
+    stack.push_back(root);
+
+    while (!stack.empty()) {
+	BuildNode n = stack.back();
+	stack.pop_back();
+
+	if (e_head == 0)
+	    ConstructUnusedList ();
+
+	labels.clear();
+	bounds.clear();
+	for (size_t i = n.begin; i < n.end; i++) {
+	    KeyType c = keys[i][n.depth];
+
+	    if (labels.empty() || labels.back() != c) {
+		labels.push_back(c);
+		bounds.push_back(i);
+	    }
+	}
+	bounds.push_back(n.end);
+
+	// R = existing labels followed by new labels
+	R.clear ();
+	if (!n.fresh)
+	    GetLabel (n.index);
+
+	size_t old = R.size();
+
+	added.assign(labels.size(), 0);
+	for (size_t i = 0; i < labels.size(); i++) {
+	    if (n.fresh || !Forward (n.index, labels[i])) {
+		R.push_back (labels[i]);
+		added[i] = 1;
+	    }
+	}
+
+	if (R.size() > old) {
+	    if (n.fresh) {
+		W_Base (n.index, X_Check (R));
+	    } else {
+		// (I-1) for all new labels
+		for (size_t i = old; i < R.size(); i++) {
+		    IndexType t = base[n.index] + R[i];
+
+		    if (t <= DA_SIZE && check[t] > 0) {
+			Modify (n.index, old);
+			break;
+		    }
+		}
+	    }
+
+	    // (I-2)
+	    for (size_t i = old; i < R.size(); i++)
+		W_Check (base[n.index] + R[i], n.index);
+	}
+
+	for (size_t i = 0; i < labels.size(); i++) {
+	    IndexType t = base[n.index] + labels[i];
+
+	    if (labels[i] == term) {
+		if (added[i]) {
+		    W_Base (t, -(NewId() + 1));
+		    count++;
+		}
+	    } else {
+		BuildNode child = { t, bounds[i], bounds[i+1], n.depth+1,
+				    added[i] };
+		stack.push_back(child);
+	    }
+	}
+    }
+
+    if (e_head == 0)
+	ConstructUnusedList ();
+
+    NUM_KEY = NUM_KEY + count;
+    if (count)
+	Header()->serial++;
+    return count;
+}
+
 /*
  * This method remove an existing key from this double array. If the
  * specified key is successfully removed, it returns 1. Otherwise, it
@@ -571,89 +1132,1622 @@ IndexType DoubleArray<IndexType, KeyType>::Remove(const KeyType *a)
 	}
     } while (base[index] >= 0); // (D-3)
 
+    FreeId (Id (index));
     Delete (index);
     NUM_KEY = NUM_KEY - 1;
+    Header()->serial++;
     return 1;
 }
 
 /*
- * Read keys from text file and add those keys to this double array.
+ * Return the id of the key whose leaf is "index" (a value returned by
+ * Search()), or -1 if "index" is not a leaf.
  *
- * == RETURN ==
- *  -1: Failed to open the specified file.
- *  0:  The number of newly added keys.
+ * Each key has an id from 0 to IdLimit()-1, which doesn't change while
+ * the key is in this double array (Relayout() keeps ids, Build() gives
+ * new ids in the order of keys). An id freed by Remove() is given to a
+ * key added later. Ids are dense (0 to NUM_KEY-1) unless keys have been
+ * removed, so that they can index arrays of attributes.
  */
 template <class IndexType, class KeyType>
-int DoubleArray<IndexType, KeyType>::loadWordList(const char *file)
+IndexType DoubleArray<IndexType, KeyType>::Id(IndexType index) const
 {
-    int len;
-    int count = 0;
-    char word[256];
-    unsigned char uword[256];
-    FILE *f;
+    if (index <= 0 || index > DA_SIZE || check[index] <= 0 || base[index] >= 0)
+	return -1;
+
+    return -base[index] - 1;
+}
+
+/*
+ * Return the id of the specified key, or -1 if it is not found.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::SearchId(const KeyType *a) const
+{
+    return Id(Search(a));
+}
 
-    f = fopen (file, "r");
-    if (!f)
+/*
+ * Restore the key of a leaf (a value returned by Search()) into "buf",
+ * ended with the terminal symbol. CHECK of a node is its parent, and the
+ * label of a node is its index minus BASE of the parent, so the key is
+ * read from the leaf up to the root without any search.
+ *
+ * Returns the length of the key without the terminal symbol, or -1 if
+ * "index" is not a leaf. If the return value is "size" or more, "buf" was
+ * too small and its content is undefined (like snprintf()).
+ */
+template <class IndexType, class KeyType>
+int DoubleArray<IndexType, KeyType>::Key(IndexType index, KeyType *buf,
+					 size_t size) const
+{
+    if (Id(index) < 0)
 	return -1;
 
-    while (fgets (word, 255, f))
-    {
-	len = strlen (word);
+    // labels from the leaf up to the root, i.e. in reverse order
+    size_t n = 0;
+    for (IndexType t = index; t != 1; n++) {
+	IndexType s = check[t];
 
-	if (len >= 1)
-	{
-	    word[len-1] = term; /* replace '\n' with terminal symbol */
-	    for (size_t i=0; i<=len; i++)
-	      uword[i] = static_cast<unsigned char>(word[i]);
+	if (s <= 0 || base[s] <= 0 || n > (size_t) DA_SIZE)
+	    return -1; // broken link
 
-	    count += Add (uword);
-	}
+	if (n < size)
+	    buf[n] = t - base[s];
+	t = s;
     }
-    fclose (f);
 
-    return count;
+    if (n <= size)
+	reverse(buf, buf + n);
+
+    return n - 1;
 }
 
-#define MIN(a,b) (a < b ? a : b)
-#define MAX(a,b) (a > b ? a : b)
+/*
+ * Make the table from ids to leaves, i.e. leaves[Id(index)] = index, by
+ * one scan of the arrays. Unused ids have 0. The table is valid until
+ * this double array is updated.
+ */
 template <class IndexType, class KeyType>
-void DoubleArray<IndexType, KeyType>::dump()
+void DoubleArray<IndexType, KeyType>::GetLeaves(vector<IndexType> &leaves) const
 {
-    int i, j;
+    leaves.assign(ID_LIMIT, 0);
 
-    for (i = 1; i <= DA_SIZE; i += 15)
-    {
-	/* print indices */
-	printf ("       ");
-	for (j = i; j <= MIN(i+14, DA_SIZE); j++)
-	    printf ("%4d", j);
-	printf ("\n");
+    for (IndexType i = 1; i <= DA_SIZE; i++)
+	if (check[i] > 0 && base[i] < 0)
+	    leaves[-base[i] - 1] = i;
+}
 
-	/* print the BASE array */
-	printf ("  BASE ");
-	for (j = i; j <= MIN(i+14, DA_SIZE); j++)
-	    printf ("%4d", base[j]);
-	printf ("\n");
+/*
+ * This method finds all keys which are prefixes of the specified key, and
+ * returns the number of such keys. For each key found from the shortest,
+ * callback(len, index) is called, where "len" is the length of the key
+ * and "index" is the index of its leaf node.
+ *
+ * Argument:
+ *   a: Key to be searched.
+ *      The end of this string must be ended with terminal symbol "term".
+ */
+template <class IndexType, class KeyType>
+template <class Callback>
+size_t DoubleArray<IndexType, KeyType>::PrefixSearch(const KeyType *a,
+						     Callback &callback) const
+{
+    if (!NUM_KEY)
+	return 0;
 
-	/* print the CHECK array */
-	printf (" CEHCK ");
-	for (j = i; j <= MIN(i+14, DA_SIZE); j++)
-	    printf ("%4d", check[j]);
-	printf ("\n");
+    IndexType index = 1;
+    size_t count = 0;
 
-	printf ("\n");
+    for (size_t pos = 0; ; pos++) {
+	IndexType t = Forward(index, term);
+	if (t) {
+	    callback(pos, t);
+	    count++;
+	}
+
+	if (a[pos] == term || (index = Forward(index, a[pos])) == 0)
+	    return count;
     }
 }
-#undef MIN
-#undef MAX
 
+/*
+ * This method finds all keys whose Levenshtein distance from the
+ * specified key is "k" or less, and returns the number of such keys.
+ *
+ * The trie is traversed in depth-first order with one row of the dynamic
+ * programming table for each depth. A branch is pruned as soon as every
+ * value of its row exceeds "k", because the distance never decreases in
+ * deeper rows. Keys are found in lexicographic order.
+ *
+ * For each key found, callback(key, len, distance, index) is called, where
+ * "key" is ended with terminal symbol "term", "len" is its length without
+ * the terminal symbol and "index" is the index of the leaf node. "key" is
+ * valid only until the callback returns.
+ *
+ * Argument:
+ *   a: Key to be searched.
+ *      The end of this string must be ended with terminal symbol "term".
+ *   k: The maximal edit distance.
+ */
 template <class IndexType, class KeyType>
-void DoubleArray<IndexType, KeyType>::printInfo()
+template <class Callback>
+size_t DoubleArray<IndexType, KeyType>::FuzzySearch(const KeyType *a, int k,
+						    Callback &callback) const
 {
-    printf ("Size of index: %d bytes\n", sizeof(IndexType));
-    printf ("Size of array: %d (%d bytes)\n",
-	    DA_SIZE, DA_SIZE*sizeof(IndexType)*2);
-    printf ("The number of keys: %d\n", NUM_KEY);
+    if (!NUM_KEY)
+	return 0;
+
+    size_t m = keylen(a);
+    size_t width = m + 1;
+    size_t count = 0;
+
+    vector<int> rows(width);  // DP rows of all depths
+    vector<KeyType> labels(max); // children of all depths
+    vector<size_t> nlabels;
+    vector<size_t> next;
+    vector<IndexType> nodes;
+    vector<KeyType> key;
+
+    for (size_t j = 0; j <= m; j++)
+	rows[j] = j;
+
+    nodes.push_back(1);
+    nlabels.push_back(GetChildren(1, &labels[0]));
+    next.push_back(0);
+
+    while (!nodes.empty()) {
+	size_t d = nodes.size() - 1;
+
+	if (next[d] == nlabels[d]) {
+	    nodes.pop_back();
+	    nlabels.pop_back();
+	    next.pop_back();
+	    if (d > 0)
+		key.pop_back();
+	    continue;
+	}
+
+	KeyType c = labels[d*max + next[d]++];
+	IndexType t = base[nodes[d]] + c;
+
+	if (c == term) {
+	    int dist = rows[d*width + m];
+
+	    if (dist <= k) {
+		key.push_back(term);
+		callback(&key[0], d, dist, t);
+		key.pop_back();
+		count++;
+	    }
+	    continue;
+	}
+
+	if (rows.size() < (d+2)*width) {
+	    rows.resize((d+2)*width);
+	    labels.resize((d+2)*max);
+	}
+
+	const int *prev = &rows[d*width];
+	int *row = &rows[(d+1)*width];
+	int lowest;
+
+	lowest = row[0] = d + 1;
+	for (size_t j = 1; j <= m; j++) {
+	    int v = prev[j-1] + (a[j-1] != c); // substitution
+	    if (prev[j] + 1 < v)
+		v = prev[j] + 1; // insertion
+	    if (row[j-1] + 1 < v)
+		v = row[j-1] + 1; // deletion
+
+	    row[j] = v;
+	    if (v < lowest)
+		lowest = v;
+	}
+
+	if (lowest > k)
+	    continue;
+
+	key.push_back(c);
+	nodes.push_back(t);
+	nlabels.push_back(GetChildren(t, &labels[(d+1)*max]));
+	next.push_back(0);
+    }
+
+    return count;
+}
+
+/*
+ * This method finds keys which match the specified pattern, and returns
+ * the number of such keys. The pattern is made of:
+ *
+ *   ?        any one symbol
+ *   *        any sequence of symbols (including the empty one)
+ *   [abc]    one of the listed symbols; "a-z" is a range, "[^...]" is the
+ *            complement and "]" just after "[" or "[^" is listed
+ *   \c       the symbol c itself
+ *   others   the symbol itself
+ *
+ * The trie is traversed in depth-first order with the set of pattern
+ * positions reached so far (one row of an NFA for each depth), and a
+ * branch is pruned as soon as the set is empty. When every position of
+ * the set is a plain symbol, only those symbols are followed by Forward()
+ * instead of scanning all children. Keys are found in lexicographic order
+ * (see Cursor).
+ *
+ * For each key found, callback(key, len, index) is called, where "key" is
+ * ended with terminal symbol "term", "len" is its length without the
+ * terminal symbol and "index" is the index of the leaf node. "key" is
+ * valid only until the callback returns.
+ *
+ * Argument:
+ *   pattern: Pattern to be matched.
+ *            The end of this string must be ended with terminal symbol
+ *            "term".
+ *   limit: The maximal number of keys to be found, or 0 for no limit.
+ */
+template <class IndexType, class KeyType>
+template <class Callback>
+size_t DoubleArray<IndexType, KeyType>::PatternSearch(const KeyType *pattern,
+						      size_t limit,
+						      Callback &callback) const
+{
+    if (!NUM_KEY)
+	return 0;
+
+    size_t span = (size_t) max + 1;
+    vector<char> star;       // element i is "*"
+    vector<KeyType> literal; // the only symbol of element i, or term
+    vector<char> accept;     // accept[i*span + c]: element i accepts c
+
+    for (const KeyType *p = pattern; *p != term; p++) {
+	size_t i = star.size();
+
+	star.push_back(0);
+	literal.push_back(term);
+	accept.resize((i+1)*span, 0);
+	char *set = &accept[i*span];
+
+	// the end of a class, if any
+	const KeyType *e = p + 1;
+	if (*p == '[') {
+	    if (*e == '^')
+		e++;
+	    if (*e == ']')
+		e++;
+	    while (*e != term && *e != ']')
+		e++;
+	}
+
+	if (*p == '*') {
+	    star[i] = 1;
+	} else if (*p == '?') {
+	    memset(set, 1, span);
+	} else if (*p == '[' && *e == ']') {
+	    const KeyType *q = p + 1;
+	    int negate = *q == '^';
+
+	    for (q += negate; q < e; q++) {
+		if (q + 2 < e && q[1] == '-') {
+		    for (size_t c = q[0]; c <= (size_t) q[2]; c++)
+			set[c] = 1;
+		    q += 2;
+		} else {
+		    set[*q] = 1;
+		}
+	    }
+
+	    if (negate)
+		for (size_t c = 0; c < span; c++)
+		    set[c] = !set[c];
+	    p = e;
+	} else {
+	    if (*p == '\\' && p[1] != term)
+		p++;
+	    set[*p] = 1;
+	    literal[i] = *p;
+	}
+
+	set[term] = 0;
+    }
+
+    size_t m = star.size();
+    size_t width = m + 1;
+    size_t count = 0;
+    int enter = 1; // the top node has just been pushed
+
+    vector<char> rows(width, 0); // NFA rows of all depths
+    vector<KeyType> labels(max);  // labels to follow at all depths
+    vector<size_t> nlabels;
+    vector<size_t> next;
+    vector<IndexType> nodes;
+    vector<KeyType> key;
+
+    rows[0] = 1;
+    for (size_t i = 0; i < m; i++)
+	if (rows[i] && star[i])
+	    rows[i+1] = 1;
+
+    nodes.push_back(1);
+    nlabels.push_back(0);
+    next.push_back(0);
+
+    while (!nodes.empty()) {
+	size_t d = nodes.size() - 1;
+
+	if (enter) {
+	    const char *row = &rows[d*width];
+	    KeyType *l = &labels[d*max];
+	    IndexType t;
+	    size_t n = 0;
+	    int scan = 0;
+
+	    enter = 0;
+
+	    if (row[m] && (t = Forward(nodes[d], term))) {
+		key.push_back(term);
+		callback(&key[0], d, t);
+		key.pop_back();
+		if (++count == limit)
+		    return count;
+	    }
+
+	    for (size_t i = 0; i < m && !scan; i++) {
+		if (!row[i])
+		    continue;
+		if (literal[i] == term || n == (size_t) max)
+		    scan = 1;
+		else
+		    l[n++] = literal[i];
+	    }
+
+	    if (scan) {
+		n = GetChildren(nodes[d], l);
+	    } else {
+		sort(l, l + n);
+		n = unique(l, l + n) - l;
+	    }
+
+	    nlabels[d] = n;
+	    continue;
+	}
+
+	if (next[d] == nlabels[d]) {
+	    nodes.pop_back();
+	    nlabels.pop_back();
+	    next.pop_back();
+	    if (d > 0)
+		key.pop_back();
+	    continue;
+	}
+
+	KeyType c = labels[d*max + next[d]++];
+	IndexType t;
+
+	if (c == term || (t = Forward(nodes[d], c)) == 0)
+	    continue;
+
+	if (rows.size() < (d+2)*width) {
+	    rows.resize((d+2)*width);
+	    labels.resize((d+2)*max);
+	}
+
+	const char *row = &rows[d*width];
+	char *child = &rows[(d+1)*width];
+	int alive = 0;
+
+	memset(child, 0, width);
+	for (size_t i = 0; i < m; i++) {
+	    if (!row[i])
+		continue;
+	    if (star[i])
+		child[i] = 1;
+	    else if (accept[i*span + c])
+		child[i+1] = 1;
+	}
+	for (size_t i = 0; i < m; i++)
+	    if (child[i] && star[i])
+		child[i+1] = 1;
+	for (size_t i = 0; i <= m; i++)
+	    alive |= child[i];
+
+	if (!alive)
+	    continue;
+
+	key.push_back(c);
+	nodes.push_back(t);
+	nlabels.push_back(0);
+	next.push_back(0);
+	enter = 1;
+    }
+
+    return count;
+}
+
+/*
+ * This method splits "text" into greedy longest-match tokens, and returns
+ * the number of tokens.
+ *
+ * From each position, the trie is walked with Forward() along the text
+ * while remembering the last node that has the terminal symbol as a
+ * child. The longest key found is emitted and the scan resumes just after
+ * it. If no key starts at a position, that position is skipped. A terminal
+ * symbol in the text is never a part of a token.
+ *
+ * For each token, callback(pos, len, index) is called, where "pos" is the
+ * offset of the token in "text", "len" is its length and "index" is the
+ * index of the leaf node (see Id()). Skipped symbols are the gaps between
+ * tokens.
+ *
+ * Argument:
+ *   text: Text to be segmented. It needs no terminal symbol.
+ *   len: The length of "text".
+ */
+template <class IndexType, class KeyType>
+template <class Callback>
+size_t DoubleArray<IndexType, KeyType>::Segment(const KeyType *text, size_t len,
+						Callback &callback) const
+{
+    size_t count = 0;
+    size_t i = 0;
+
+    while (i < len) {
+	IndexType s = 1;
+	IndexType leaf = 0;
+	size_t n = 0;
+
+	for (size_t j = i; j < len && text[j] != term; j++) {
+	    if ((s = Forward(s, text[j])) == 0)
+		break;
+
+	    IndexType t = Forward(s, term);
+	    if (t) {
+		leaf = t;
+		n = j + 1 - i;
+	    }
+	}
+
+	if (leaf) {
+	    callback(i, n, leaf);
+	    count++;
+	    i += n;
+	} else {
+	    i++;
+	}
+    }
+
+    return count;
+}
+
+template <class IndexType, class KeyType>
+bool DoubleArray<IndexType, KeyType>::KeyLess::operator()(const KeyType *a,
+							  const KeyType *b) const
+{
+    // The terminal symbol is the smallest label, so that a key is placed
+    // before the other keys which have it as a prefix.
+    for (size_t i = 0; ; i++) {
+	if (a[i] == b[i]) {
+	    if (a[i] == term)
+		return false;
+	} else if (a[i] == term) {
+	    return true;
+	} else if (b[i] == term) {
+	    return false;
+	} else {
+	    return a[i] < b[i];
+	}
+    }
+}
+
+/*
+ * Sort keys (unless they are already sorted) and remove duplicated keys.
+ */
+template <class IndexType, class KeyType>
+void DoubleArray<IndexType, KeyType>::SortKeys(vector<const KeyType *> &keys)
+{
+    KeyLess less(term);
+    size_t n = 0;
+
+    for (size_t i = 1; i < keys.size(); i++) {
+	if (less(keys[i], keys[i-1])) {
+	    sort(keys.begin(), keys.end(), less);
+	    break;
+	}
+    }
+
+    for (size_t i = 0; i < keys.size(); i++)
+	if (n == 0 || less(keys[n-1], keys[i]))
+	    keys[n++] = keys[i];
+    keys.resize(n);
+}
+
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::FindFree(vector<IndexType> &next_free,
+						    IndexType index)
+{
+    IndexType r = index;
+
+    while ((size_t) r < next_free.size() && next_free[r] != r)
+	r = next_free[r];
+
+    while ((size_t) index < next_free.size() && next_free[index] != index) {
+	IndexType next = next_free[index];
+	next_free[index] = r;
+	index = next;
+    }
+
+    return r;
+}
+
+/*
+ * Construct the subtree of the node for the first label of a shard in the
+ * private arrays of the shard. Index 0 of these arrays is the node for the
+ * first label, whose children are placed from index 1.
+ *
+ * This method doesn't touch any member, so that shards can be built by
+ * multiple threads at the same time.
+ */
+template <class IndexType, class KeyType>
+void DoubleArray<IndexType, KeyType>::BuildShard(const KeyType * const *keys,
+						 Shard &sh,
+						 KeyType term)
+{
+    vector<BuildNode> stack;
+    vector<KeyType> labels;
+    vector<size_t> bounds;
+
+    // next_free[i] leads to the first unused index after i (i itself if
+    // it is unused). Paths are compressed while they are followed, so
+    // that used cells are skipped in almost constant time.
+    vector<IndexType> next_free(1, 1);
+
+    sh.base.assign(1, 0);
+    sh.check.assign(1, 0);
+    sh.used.assign(1, 1);
+
+    BuildNode root = { 0, sh.begin, sh.end, 1, 0 };
+    stack.push_back(root);
+
+    while (!stack.empty()) {
+	BuildNode n = stack.back();
+	stack.pop_back();
+
+	// Keys in [n.begin, n.end) are sorted and share the first n.depth
+	// labels, so that each child is a contiguous range of keys.
+	labels.clear();
+	bounds.clear();
+	for (size_t i = n.begin; i < n.end; i++) {
+	    KeyType c = keys[i][n.depth];
+
+	    if (labels.empty() || labels.back() != c) {
+		labels.push_back(c);
+		bounds.push_back(i);
+	    }
+	}
+	bounds.push_back(n.end);
+
+	KeyType c1 = *min_element(labels.begin(), labels.end());
+	KeyType cn = *max_element(labels.begin(), labels.end());
+
+	// (X-1), (X-2) on the private arrays
+	IndexType q;
+	for (IndexType p = FindFree(next_free, c1+1); ;
+	     p = FindFree(next_free, p+1)) {
+	    q = p - c1;
+
+	    size_t i;
+	    for (i = 0; i < labels.size(); i++)
+		if ((size_t) (q+labels[i]) < sh.used.size() &&
+		    sh.used[q+labels[i]])
+		    break;
+
+	    if (i == labels.size())
+		break;
+	}
+
+	if (sh.used.size() <= (size_t) (q+cn)) {
+	    sh.base.resize(q+cn+1, 0);
+	    sh.check.resize(q+cn+1, 0);
+	    sh.used.resize(q+cn+1, 0);
+
+	    for (IndexType i = next_free.size(); i <= q+cn; i++)
+		next_free.push_back(i);
+	}
+
+	sh.base[n.index] = q;
+	for (size_t i = 0; i < labels.size(); i++) {
+	    IndexType t = q + labels[i];
+
+	    sh.used[t] = 1;
+	    next_free[t] = t + 1;
+	    sh.check[t] = n.index;
+
+	    if (labels[i] == term) {
+		// The key bounds[i] is the only key under this leaf. Its
+		// position in the sorted keys is its id.
+		sh.base[t] = -(IndexType) (bounds[i] + 1);
+	    } else {
+		BuildNode child = { t, bounds[i], bounds[i+1], n.depth+1, 0 };
+		stack.push_back(child);
+	    }
+	}
+    }
+}
+
+template <class IndexType, class KeyType>
+void *DoubleArray<IndexType, KeyType>::BuildWorker(void *arg)
+{
+    BuildContext *ctx = static_cast<BuildContext *>(arg);
+
+    while (1) {
+	pthread_mutex_lock(&ctx->lock);
+	size_t i = ctx->next++;
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (i >= ctx->order.size())
+	    break;
+
+	BuildShard(ctx->keys, (*ctx->shards)[ctx->order[i]], ctx->term);
+    }
+
+    return NULL;
+}
+
+/*
+ * This method replaces the content of this double array with the
+ * specified keys, and returns the number of distinct keys.
+ *
+ * The keys are sorted (unless they are already sorted) and partitioned by
+ * their first label. The subtree under each child of the root is built
+ * by one of "threads" threads into a private array, and then these arrays
+ * are relocated one after another behind the children of the root.
+ *
+ * The id of each key is its position in the sorted keys (see Id()).
+ *
+ * Arguments:
+ *   keys:    Keys to be added. Each key must be ended with terminal
+ *            symbol "term". This vector is sorted and duplicated keys
+ *            are removed.
+ *   threads: The number of threads. If it is 0 or less, the number of
+ *            online processors is used.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::Build(vector<const KeyType *> &keys,
+						 int threads)
+{
+    SortKeys(keys);
+
+    // partition by the first label
+    vector<Shard> shards;
+    int empty_key = 0;
+
+    for (size_t i = 0; i < keys.size(); i++) {
+	if (keys[i][0] == term) {
+	    empty_key = 1;
+	} else if (shards.empty() || shards.back().label != keys[i][0]) {
+	    shards.push_back(Shard());
+	    shards.back().begin = i;
+	    shards.back().end = i + 1;
+	    shards.back().label = keys[i][0];
+	} else {
+	    shards.back().end = i + 1;
+	}
+    }
+
+    // build shards (larger ones first)
+    BuildContext ctx;
+    vector<pair<size_t, size_t> > sizes;
+
+    for (size_t i = 0; i < shards.size(); i++)
+	sizes.push_back(make_pair(shards[i].end - shards[i].begin, i));
+    sort(sizes.rbegin(), sizes.rend());
+    for (size_t i = 0; i < sizes.size(); i++)
+	ctx.order.push_back(sizes[i].second);
+
+    ctx.keys = keys.empty() ? NULL : &keys[0];
+    ctx.shards = &shards;
+    ctx.next = 0;
+    ctx.term = term;
+    pthread_mutex_init(&ctx.lock, NULL);
+
+    if (threads <= 0)
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((size_t) threads > shards.size())
+	threads = shards.size();
+
+    vector<pthread_t> workers(threads > 1 ? threads - 1 : 0);
+    for (size_t i = 0; i < workers.size(); i++)
+	if (pthread_create(&workers[i], NULL, BuildWorker, &ctx) != 0)
+	    workers.resize(i);
+
+    BuildWorker(&ctx);
+
+    for (size_t i = 0; i < workers.size(); i++)
+	pthread_join(workers[i], NULL);
+    pthread_mutex_destroy(&ctx.lock);
+
+    // merge shards
+    IndexType size = 1 + max;
+
+    for (size_t i = 0; i < shards.size(); i++) {
+	shards[i].offset = size;
+	size += shards[i].base.size() - 1;
+    }
+
+    Clear();
+    base.expand_to(size);
+    check.expand_to(size);
+
+    NUM_KEY = keys.size();
+    DA_SIZE = size;
+    ID_LIMIT = keys.size();
+
+    if (empty_key) {
+	base[1+term] = -1; // id 0, since the empty key is the first
+	check[1+term] = 1;
+    }
+
+    for (size_t i = 0; i < shards.size(); i++) {
+	Shard &sh = shards[i];
+	IndexType root = 1 + sh.label;
+
+	base[root] = sh.base[0] + sh.offset;
+	check[root] = 1;
+
+	for (size_t j = 1; j < sh.base.size(); j++) {
+	    if (!sh.used[j])
+		continue;
+
+	    IndexType t = sh.offset + j;
+
+	    base[t] = sh.base[j] > 0 ? sh.base[j] + sh.offset : sh.base[j];
+	    check[t] = sh.check[j] ? sh.check[j] + sh.offset : root;
+	}
+    }
+
+    return NUM_KEY;
+}
+
+/*
+ * Rewrite this double array so that a lookup touches fewer cache lines
+ * and pages. The keys, the leaf values and NUM_KEY are kept; only the
+ * positions of the nodes change.
+ *
+ * The nodes are visited in depth-first order from the root, and the
+ * children of each node are placed at the first free block. The free
+ * cells are used up from the front, so the children of a node land just
+ * behind the blocks of its ancestors, and a lookup walks forward through
+ * a few nearby pages. (Breadth-first order spreads each path over one
+ * region per depth and touches about twice as many pages.) The unused
+ * element list is rebuilt afterwards.
+ *
+ * Returns the new size of the array.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::Relayout()
+{
+    vector<unsigned long long> hits;
+
+    return RelayoutByHits(hits);
+}
+
+/*
+ * Same as Relayout(), but the nodes are visited in descending order of
+ * the number of lookups which passed through them in a query log, so
+ * that the hottest paths are packed into the first pages. Nodes which
+ * are not in the log follow in depth-first order.
+ *
+ * Each line of the log is a key looked up by an application. A line may
+ * begin with a count and a tab character, which stands for that many
+ * lookups of the rest of the line (see MappedWordList). Keys which are not in this double
+ * array count for the nodes on their way until the lookup failed.
+ *
+ * == RETURN ==
+ *  -1: Failed to open the specified file.
+ *  0:  The new size of the array.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::RelayoutByProfile(const char *file)
+{
+    vector<unsigned long long> hits(DA_SIZE + 1, 0);
+    const KeyType *word;
+    size_t len;
+    unsigned long long count;
+
+    try {
+	MappedWordList<KeyType> list(file, term);
+
+	while ((word = list.Next(&len, &count))) {
+	    // (D-1) - (D-3)
+	    IndexType index = 1;
+	    hits[index] += count;
+	    for (size_t pos = 0; base[index] >= 0; pos++) {
+		index = Forward (index, word[pos]);
+		if (index == 0)
+		    break;
+		hits[index] += count;
+	    }
+	}
+    } catch (int e) {
+	return -1;
+    }
+
+    return RelayoutByHits(hits);
+}
+
+/*
+ * Place the nodes into new arrays in descending order of "hits", which
+ * is indexed by the current positions. Nodes with the same number of
+ * hits are visited in depth-first order. If "hits" is empty, every node
+ * has no hit.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::RelayoutByHits(
+    const vector<unsigned long long> &hits)
+{
+    vector<IndexType> nb(2, 0), nc(2, 0), next_free(2, 0);
+    vector<char> used(2, 0);
+    priority_queue<RelayoutNode> queue;
+    vector<KeyType> labels(max + 1);
+    size_t seq = 0;
+
+    used[1] = 1;
+    next_free[1] = 2;
+    next_free[0] = 1;
+
+    RelayoutNode root = { 1, 1, 0, seq++ };
+    queue.push(root);
+
+    while (!queue.empty()) {
+	RelayoutNode n = queue.top();
+	queue.pop();
+
+	size_t count = GetChildren(n.from, &labels[0]);
+	if (count == 0)
+	    continue;
+
+	IndexType q = Place(&labels[0], count, n.to, nb, nc, used, next_free);
+
+	// push children in reverse order, so that the first label is
+	// visited first among children with the same number of hits
+	for (size_t i = count; i-- > 0; ) {
+	    IndexType t = q + labels[i];
+	    IndexType from = base[n.from] + labels[i];
+
+	    if (base[from] < 0) {
+		nb[t] = base[from]; // leaf
+	    } else {
+		RelayoutNode child = { from, t,
+				       hits.empty() ? 0 : hits[from], seq++ };
+		queue.push(child);
+	    }
+	}
+    }
+
+    return Install(nb, nc);
+}
+
+/*
+ * Add all keys of "other" to this double array by walking both tries in
+ * lockstep, and place the merged trie into new arrays in depth-first
+ * order as Relayout() does. Each node of the result is visited once, so
+ * that the cost is proportional to the size of the result rather than to
+ * the number of keys re-inserted by Add().
+ *
+ * Keys of this double array keep their ids, and the other keys get new
+ * ids as Add() gives them. For each key of "other", callback(id,
+ * other_id, conflict) is called, where "id" is the id of the key in this
+ * double array, "other_id" is that in "other" and "conflict" is 1 if the
+ * key was already in this double array. The callback decides which value
+ * (e.g. attributes indexed by ids) wins.
+ *
+ * "other" must have the same terminal symbol, and its labels must not
+ * exceed "max".
+ *
+ * == RETURN ==
+ *  -1: "other" is not compatible with this double array.
+ *  0:  The number of keys added.
+ */
+template <class IndexType, class KeyType>
+template <class Callback>
+IndexType DoubleArray<IndexType, KeyType>::Merge(const DoubleArray &other,
+						 Callback &callback)
+{
+    if (other.term != term || other.max > max)
+	return -1;
+
+    vector<IndexType> nb(2, 0), nc(2, 0), next_free(2, 0);
+    vector<char> used(2, 0);
+    vector<MergeNode> stack;
+    vector<KeyType> labels(2 * max), la(max), lb(max);
+    IndexType added = 0;
+
+    used[1] = 1;
+    next_free[1] = 2;
+    next_free[0] = 1;
+
+    MergeNode root = { 1, 1, 1 };
+    stack.push_back(root);
+
+    while (!stack.empty()) {
+	MergeNode n = stack.back();
+	stack.pop_back();
+
+	size_t na = n.a ? GetChildren(n.a, &la[0]) : 0;
+	size_t nb_ = n.b ? other.GetChildren(n.b, &lb[0]) : 0;
+	size_t count = set_union(la.begin(), la.begin() + na,
+				 lb.begin(), lb.begin() + nb_,
+				 labels.begin()) - labels.begin();
+	if (count == 0)
+	    continue;
+
+	IndexType q = Place(&labels[0], count, n.to, nb, nc, used, next_free);
+
+	// push children in reverse order, so that the first label is
+	// visited first
+	for (size_t i = count; i-- > 0; ) {
+	    KeyType c = labels[i];
+	    IndexType t = q + c;
+	    IndexType a = n.a ? Forward(n.a, c) : 0;
+	    IndexType b = n.b ? other.Forward(n.b, c) : 0;
+
+	    if (c != term) {
+		MergeNode child = { a, b, t };
+		stack.push_back(child);
+		continue;
+	    }
+
+	    IndexType id;
+	    if (a) {
+		id = Id(a);
+	    } else {
+		id = NewId();
+		added++;
+	    }
+
+	    nb[t] = -(id+1);
+	    if (b)
+		callback(id, other.Id(b), a != 0);
+	}
+    }
+
+    Install(nb, nc);
+
+    NUM_KEY = NUM_KEY + added;
+    if (added)
+	Header()->serial++;
+
+    return added;
+}
+
+/*
+ * Place the children of "parent" (with the ascending "labels") at the
+ * first free block of new arrays "nb" and "nc", which are expanded if
+ * needed. "used" and "next_free" (see FindFree()) keep track of the used
+ * cells. BASE of "parent" and CHECK of the children are set, and the new
+ * BASE value is returned.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::Place(const KeyType *labels,
+						 size_t count,
+						 IndexType parent,
+						 vector<IndexType> &nb,
+						 vector<IndexType> &nc,
+						 vector<char> &used,
+						 vector<IndexType> &next_free)
+{
+    KeyType c1 = labels[0];
+    KeyType cn = labels[count-1];
+
+    // (X-1), (X-2) on the new arrays
+    IndexType q;
+    for (IndexType p = FindFree(next_free, c1+1); ;
+	 p = FindFree(next_free, p+1)) {
+	q = p - c1;
+
+	size_t i;
+	for (i = 0; i < count; i++)
+	    if ((size_t) (q+labels[i]) < used.size() && used[q+labels[i]])
+		break;
+
+	if (i == count)
+	    break;
+    }
+
+    if (used.size() <= (size_t) (q+cn)) {
+	nb.resize(q+cn+1, 0);
+	nc.resize(q+cn+1, 0);
+	used.resize(q+cn+1, 0);
+
+	for (IndexType i = next_free.size(); i <= q+cn; i++)
+	    next_free.push_back(i);
+    }
+
+    nb[parent] = q;
+
+    for (size_t i = 0; i < count; i++) {
+	IndexType t = q + labels[i];
+
+	used[t] = 1;
+	next_free[t] = t + 1;
+	nc[t] = parent;
+    }
+
+    return q;
+}
+
+/*
+ * Replace the arrays with "nb" and "nc" made by Place(). The number of
+ * keys, ids and "pair" are kept, so that files of attributes stay valid.
+ * "serial" is increased, since the cells of the nodes change. Returns the
+ * new size of the array.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::Install(const vector<IndexType> &nb,
+						   const vector<IndexType> &nc)
+{
+    IndexType size = nb.size() - 1;
+    IndexType keys = NUM_KEY;
+    IndexType id_limit = ID_LIMIT;
+    uint32_t pair = Header()->pair;
+    vector<IndexType> ids;
+    int ids_valid = free_ids_valid;
+
+    ids.swap(free_ids);
+
+    Clear();
+    base.expand_to(size);
+    check.expand_to(size);
+
+    NUM_KEY = keys;
+    DA_SIZE = size;
+    ID_LIMIT = id_limit;
+    Header()->pair = pair;
+    HeaderOfCheck()->pair = pair;
+    free_ids.swap(ids);
+    free_ids_valid = ids_valid;
+
+    for (IndexType i = 1; i <= size; i++) {
+	base[i] = nb[i];
+	check[i] = nc[i];
+    }
+
+    if (base[1] == 0)
+	base[1] = 1; // no key, as Clear() leaves it
+
+    ConstructUnusedList();
+
+    return size;
+}
+
+/*
+ * Read keys from text file and add those keys to this double array.
+ * The file is mapped to memory and each line is added in place, so there
+ * is no limit of the length of a key.
+ *
+ * == RETURN ==
+ *  -1: Failed to open the specified file.
+ *  0:  The number of newly added keys.
+ */
+template <class IndexType, class KeyType>
+int DoubleArray<IndexType, KeyType>::loadWordList(const char *file)
+{
+    int count = 0;
+    int opened = 0;
+    const KeyType *word;
+    size_t len;
+
+    try {
+	MappedWordList<KeyType> list(file, term);
+	opened = 1;
+
+	while ((word = list.Next(&len)))
+	    count += Add(word);
+    } catch (int e) {
+	if (opened)
+	    throw; // failed to update the double array.
+
+	return -1;
+    }
+
+    return count;
+}
+
+/*
+ * Read sorted keys from text file and replace the content of this double
+ * array with those keys by Build().
+ *
+ * == RETURN ==
+ *  -1: Failed to open the specified file.
+ *  0:  The number of keys.
+ */
+template <class IndexType, class KeyType>
+int DoubleArray<IndexType, KeyType>::loadSortedWordList(const char *file,
+							int threads)
+{
+    vector<const KeyType *> keys;
+    const KeyType *word;
+    size_t len;
+    int opened = 0;
+
+    try {
+	MappedWordList<KeyType> list(file, term);
+	opened = 1;
+
+	while ((word = list.Next(&len)))
+	    keys.push_back(word);
+
+	return Build(keys, threads);
+    } catch (int e) {
+	if (opened)
+	    throw; // failed to update the double array.
+
+	return -1;
+    }
+}
+
+/*
+ * Write a snapshot of this double array, which can be opened by Snapshot
+ * and published by SnapshotHolder. The snapshot is written to "file.tmp"
+ * and renamed to "file", so that readers never see a partial file.
+ *
+ * == RETURN ==
+ *  -1: Failed to write the snapshot.
+ *  0:  Succeeded.
+ */
+template <class IndexType, class KeyType>
+int DoubleArray<IndexType, KeyType>::WriteSnapshot(const char *file) const
+{
+    vector<char> tmp(strlen(file) + 5);
+    FILE *f;
+
+    sprintf (&tmp[0], "%s.tmp", file);
+
+    if (!(f = fopen (&tmp[0], "wb")))
+	return -1;
+
+    if (WriteSnapshot (f) != 0 ||
+	fflush (f) != 0 ||
+	fsync (fileno (f)) != 0) {
+	fclose (f);
+	unlink (&tmp[0]);
+	return -1;
+    }
+
+    if (fclose (f) != 0 || rename (&tmp[0], file) != 0) {
+	unlink (&tmp[0]);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the snapshot image to "f" at its current position. It returns 0
+ * on success, or -1 if writing fails.
+ */
+template <class IndexType, class KeyType>
+int DoubleArray<IndexType, KeyType>::WriteSnapshot(FILE *f) const
+{
+    FileHeader h;
+    size_t n = DA_SIZE + 1;
+
+    InitHeader<IndexType, KeyType>(&h, term, max);
+    h.num_key = NUM_KEY;
+    h.da_size = DA_SIZE;
+    h.e_head = e_head;
+    h.id_limit = ID_LIMIT;
+    h.pair = Header()->pair;
+    h.checksum = Checksum(&check[0], n * sizeof(IndexType),
+			  Checksum(&base[0], n * sizeof(IndexType)));
+
+    if (fwrite (&h, sizeof(h), 1, f) != 1 ||
+	fwrite (&base[0], sizeof(IndexType), n, f) != n ||
+	fwrite (&check[0], sizeof(IndexType), n, f) != n)
+	return -1;
+
+    return 0;
+}
+
+#define MIN(a,b) (a < b ? a : b)
+#define MAX(a,b) (a > b ? a : b)
+template <class IndexType, class KeyType>
+void DoubleArray<IndexType, KeyType>::dump() const
+{
+    IndexType i, j;
+
+    for (i = 1; i <= DA_SIZE; i += 15)
+    {
+	/* print indices */
+	printf ("       ");
+	for (j = i; j <= MIN(i+14, DA_SIZE); j++)
+	    printf ("%4lld", (long long) j);
+	printf ("\n");
+
+	/* print the BASE array */
+	printf ("  BASE ");
+	for (j = i; j <= MIN(i+14, DA_SIZE); j++)
+	    printf ("%4lld", (long long) base[j]);
+	printf ("\n");
+
+	/* print the CHECK array */
+	printf (" CEHCK ");
+	for (j = i; j <= MIN(i+14, DA_SIZE); j++)
+	    printf ("%4lld", (long long) check[j]);
+	printf ("\n");
+
+	printf ("\n");
+    }
+}
+#undef MIN
+#undef MAX
+
+template <class IndexType, class KeyType>
+void DoubleArray<IndexType, KeyType>::printInfo() const
+{
+    printf ("Size of index: %lu bytes\n", (unsigned long) sizeof(IndexType));
+    printf ("Size of array: %lld (%lld bytes)\n",
+	    (long long) DA_SIZE,
+	    (long long) DA_SIZE * (long long) sizeof(IndexType) * 2);
+    printf ("The number of keys: %lld\n", (long long) NUM_KEY);
+    printf ("Limit of key ids: %lld\n", (long long) ID_LIMIT);
+}
+
+/*
+ * Set depth[i] to the depth of cell i (0 for the root, and the depth of
+ * the parent plus 1 for others), or -1 if the cell is not used. A parent
+ * may be placed after its children, so the depth of each chain of
+ * parents is filled in on the way back.
+ */
+template <class IndexType, class KeyType>
+void DoubleArray<IndexType, KeyType>::Depths(vector<int> &depth) const
+{
+    vector<IndexType> chain;
+
+    depth.assign(DA_SIZE + 1, -1);
+    depth[1] = 0;
+
+    for (IndexType i = 2; i <= DA_SIZE; i++) {
+	IndexType s = i;
+
+	while (depth[s] < 0 && check[s] > 0) {
+	    chain.push_back(s);
+	    s = check[s];
+	}
+
+	// A chain which doesn't reach the root is left unused.
+	for (int d = depth[s]; !chain.empty(); chain.pop_back())
+	    depth[chain.back()] = d < 0 ? d : ++d;
+    }
+}
+
+/*
+ * Print how much of BASE and CHECK is in memory, what the cells are used
+ * for, and the nodes at each depth. "Pages" is the number of pages of
+ * both arrays which hold the nodes up to the depth, i.e. the page cache
+ * needed to keep them in memory, and "Resident" is how many of those
+ * pages are in memory now.
+ */
+template <class IndexType, class KeyType>
+void DoubleArray<IndexType, KeyType>::printMemory() const
+{
+    size_t page = base.page_size();
+    vector<unsigned char> in_base, in_check;
+    size_t pages = base.pages() + check.pages();
+    size_t resident = base.resident(in_base) + check.resident(in_check);
+
+    printf ("Mapped: %lu pages (%lu bytes), resident %lu pages (%.1f%%)\n",
+	    (unsigned long) pages, (unsigned long) (pages * page),
+	    (unsigned long) resident, pages ? 100.0 * resident / pages : 0.0);
+
+    vector<int> depth;
+    long long nodes = 0, leaves = 0, unused = 0, listed = 0;
+
+    Depths(depth);
+    for (IndexType i = 1; i <= DA_SIZE; i++) {
+	if (depth[i] < 0)
+	    unused++;
+	else if (base[i] < 0)
+	    leaves++;
+	else
+	    nodes++;
+    }
+
+    // Stop at DA_SIZE steps in case the list is broken.
+    for (IndexType i = e_head; i > 0 && i <= DA_SIZE && listed < DA_SIZE;
+	 i = -check[i])
+	listed++;
+
+    printf ("Cells: %lld (%lld nodes, %lld leaves, %lld unused, "
+	    "%lld in the unused list)\n",
+	    (long long) DA_SIZE, nodes, leaves, unused, listed);
+
+    int max_depth = 0;
+    for (IndexType i = 1; i <= DA_SIZE; i++)
+	max_depth = depth[i] > max_depth ? depth[i] : max_depth;
+
+    vector<long long> count(max_depth + 1), leaf_count(max_depth + 1);
+    vector<int> first(base.page_of(DA_SIZE) + 1, -1); // shallowest depth
+    for (IndexType i = 1; i <= DA_SIZE; i++) {
+	if (depth[i] < 0)
+	    continue;
+
+	count[depth[i]]++;
+	leaf_count[depth[i]] += base[i] < 0;
+
+	size_t p = base.page_of(i);
+	if (first[p] < 0 || depth[i] < first[p])
+	    first[p] = depth[i];
+    }
+
+    // BASE and CHECK have the same header, so cell i is on the same page
+    // of both.
+    vector<long long> need(max_depth + 1), hot(max_depth + 1);
+    for (size_t p = 0; p < first.size(); p++) {
+	if (first[p] < 0)
+	    continue;
+
+	need[first[p]] += 2;
+	hot[first[p]] += in_base[p] + in_check[p];
+    }
+
+    printf ("Depth\tNodes\tLeaves\tPages\tResident\n");
+    for (int d = 0; d <= max_depth; d++) {
+	if (d > 0) {
+	    need[d] += need[d-1];
+	    hot[d] += hot[d-1];
+	}
+	printf ("%d\t%lld\t%lld\t%lld\t%lld\n",
+		d, count[d], leaf_count[d], need[d], hot[d]);
+    }
+}
+
+/*
+ * Read the pages of BASE and CHECK which hold the nodes up to "depth"
+ * into memory, so that the first lookups after opening don't wait for
+ * the disk. All pages up to DA_SIZE are read if "depth" is negative.
+ * The return value is the number of pages read in each array.
+ */
+template <class IndexType, class KeyType>
+size_t DoubleArray<IndexType, KeyType>::WarmUp(int depth) const
+{
+    size_t last = base.page_of(DA_SIZE);
+
+    if (depth < 0) {
+	base.prefault(0, last);
+	check.prefault(0, last);
+	return last + 1;
+    }
+
+    // Walk down from the root, so that only the pages of the nodes up to
+    // "depth" are read.
+    vector<char> hot(last + 1);
+    vector<KeyType> labels(max + 1);
+    queue<pair<IndexType, int> > nodes;
+
+    nodes.push(make_pair((IndexType) 1, 0));
+    while (!nodes.empty()) {
+	IndexType s = nodes.front().first;
+	int d = nodes.front().second;
+
+	nodes.pop();
+	hot[base.page_of(s)] = 1;
+	if (d == depth)
+	    continue;
+
+	size_t n = GetChildren(s, &labels[0]);
+	for (size_t i = 0; i < n; i++)
+	    nodes.push(make_pair(base[s] + labels[i], d + 1));
+    }
+
+    // Runs of hot pages are read by one call.
+    size_t count = 0;
+    for (size_t p = 0; p <= last; p++) {
+	if (!hot[p])
+	    continue;
+
+	size_t q = p;
+	while (q < last && hot[q+1])
+	    q++;
+
+	base.prefault(p, q);
+	check.prefault(p, q);
+	count += q - p + 1;
+	p = q;
+    }
+
+    return count;
+}
+
+/*
+ * Check the structure of this double array, and return the number of
+ * problems found (0 if it is consistent). If "verbose" is not 0, the
+ * first problems are printed. The checks are:
+ *
+ *  - The root is cell 1, and has no parent.
+ *  - The parent of every used cell is a used cell with a positive BASE,
+ *    and the label (the cell minus BASE of the parent) is from 1 to max.
+ *  - A cell is a leaf (negative BASE) if and only if its label is the
+ *    terminal symbol. (Remove() frees only the leaf, so a node may have
+ *    no child.)
+ *  - Every used cell reaches the root through its parents.
+ *  - NUM_KEY is the number of leaves. The ids of leaves are unique and
+ *    less than ID_LIMIT, and together with the freed ids (if known) they
+ *    are all ids below ID_LIMIT.
+ *  - The unused element list holds unused cells in ascending order, and
+ *    ends with a link beyond DA_SIZE.
+ */
+template <class IndexType, class KeyType>
+size_t DoubleArray<IndexType, KeyType>::Verify(int verbose) const
+{
+    size_t problems = 0;
+
+#define MADA_PROBLEM(cond, args)			\
+    if (cond) {						\
+	if (verbose && problems < 10) {			\
+	    printf ("Problem: ");			\
+	    printf args;				\
+	    printf ("\n");				\
+	}						\
+	problems++;					\
+    }
+
+    MADA_PROBLEM(DA_SIZE < 1 || base[1] <= 0 || check[1] != 0,
+		 ("root: BASE %lld, CHECK %lld", (long long) base[1],
+		  (long long) check[1]));
+    if (problems)
+	return problems;
+
+    vector<char> id_used(ID_LIMIT, 0);
+    IndexType leaves = 0;
+
+    for (IndexType t = 2; t <= DA_SIZE; t++) {
+	IndexType s = check[t];
+
+	if (s <= 0)
+	    continue;
+
+	if (s > DA_SIZE || (s != 1 && check[s] <= 0) || base[s] <= 0) {
+	    MADA_PROBLEM(1, ("cell %lld: parent %lld is not a node",
+			     (long long) t, (long long) s));
+	    continue;
+	}
+
+	IndexType label = t - base[s];
+	MADA_PROBLEM(label < 1 || label > (IndexType) max,
+		     ("cell %lld: label %lld out of range",
+		      (long long) t, (long long) label));
+	MADA_PROBLEM((label == (IndexType) term) != (base[t] < 0),
+		     ("cell %lld: label %lld, BASE %lld", (long long) t,
+		      (long long) label, (long long) base[t]));
+
+	if (base[t] < 0) {
+	    IndexType id = -base[t] - 1;
+
+	    leaves++;
+	    if (id >= ID_LIMIT) {
+		MADA_PROBLEM(1, ("leaf %lld: id %lld beyond the limit",
+				 (long long) t, (long long) id));
+	    } else {
+		MADA_PROBLEM(id_used[id], ("id %lld is used twice",
+					   (long long) id));
+		id_used[id] = 1;
+	    }
+	}
+    }
+
+    // Cells which don't reach the root. A chain of parents longer than
+    // DA_SIZE is a loop.
+    vector<char> reached(DA_SIZE + 1, 0);
+    reached[1] = 1;
+    for (IndexType t = 2; t <= DA_SIZE; t++) {
+	if (check[t] <= 0)
+	    continue;
+
+	IndexType s = t, steps = 0;
+	while (!reached[s] && check[s] > 0 && check[s] <= DA_SIZE &&
+	       steps <= DA_SIZE) {
+	    s = check[s];
+	    steps++;
+	}
+	MADA_PROBLEM(!reached[s], ("cell %lld doesn't reach the root",
+				   (long long) t));
+	if (reached[s])
+	    for (s = t; !reached[s]; s = check[s])
+		reached[s] = 1;
+    }
+
+    MADA_PROBLEM(leaves != NUM_KEY, ("%lld leaves, NUM_KEY %lld",
+				     (long long) leaves, (long long) NUM_KEY));
+
+    if (free_ids_valid) {
+	IndexType freed = 0;
+
+	for (size_t i = 0; i < free_ids.size(); i++) {
+	    IndexType id = free_ids[i];
+
+	    if (id < 0 || id >= ID_LIMIT || id_used[id]) {
+		MADA_PROBLEM(1, ("freed id %lld is in use or out of range",
+				 (long long) id));
+		continue;
+	    }
+	    id_used[id] = 1;
+	    freed++;
+	}
+	MADA_PROBLEM(leaves + freed != ID_LIMIT,
+		     ("%lld ids in use, %lld freed, ID_LIMIT %lld",
+		      (long long) leaves, (long long) freed,
+		      (long long) ID_LIMIT));
+    }
+
+    if (e_head) {
+	IndexType i = e_head, prev = 0, steps = 0;
+
+	for (; i > 0 && i <= DA_SIZE && steps <= DA_SIZE; steps++) {
+	    if (check[i] >= 0 || i <= prev) {
+		MADA_PROBLEM(1, ("unused element list: cell %lld after %lld",
+				 (long long) i, (long long) prev));
+		break;
+	    }
+	    prev = i;
+	    i = -check[i];
+	}
+	MADA_PROBLEM(i <= DA_SIZE, ("unused element list doesn't end"));
+    }
+
+#undef MADA_PROBLEM
+
+    return problems;
+}
+
+
+/*
+ * Collect the labels of the children of every node which has "min" or
+ * more children. The labels of the i-th node are labels[offsets[i]] ...
+ * labels[offsets[i+1]-1], so "offsets" has one more element than there
+ * are nodes.
+ */
+template <class IndexType, class KeyType>
+void DoubleArray<IndexType, KeyType>::LabelSets(vector<KeyType> &labels,
+						vector<size_t> &offsets,
+						size_t min) const
+{
+    vector<KeyType> buf(max + 1);
+
+    labels.clear();
+    offsets.assign(1, 0);
+    for (IndexType s = 1; s <= DA_SIZE; s++) {
+	size_t n = GetChildren(s, &buf[0]);
+
+	if (n == 0 || n < min)
+	    continue;
+	labels.insert(labels.end(), buf.begin(), buf.begin() + n);
+	offsets.push_back(labels.size());
+    }
+}
+
+/*
+ * Return the BASE which X_Check() would choose for a node whose children
+ * have "labels" (n labels in ascending order). If "linear" is not 0, the
+ * linear search is used even if the unused element list is in use. The
+ * array is not modified.
+ */
+template <class IndexType, class KeyType>
+IndexType DoubleArray<IndexType, KeyType>::FindBase(const KeyType *labels,
+						    size_t n, int linear)
+{
+    IndexType saved = e_head;
+
+    R.clear();
+    for (size_t i = 0; i < n; i++)
+	R.push_back(labels[i]);
+
+    if (linear)
+	e_head = 0;
+    IndexType q = X_Check(R);
+    e_head = saved;
+
+    return q;
 }
 
 }
@@ -0,0 +1,152 @@
+/*
+ * FileHeader.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Header written at the beginning of files of this library.
+ *
+ * The header records the parameters of the double array, so that a file
+ * written with another IndexType, KeyType, terminal symbol or byte order
+ * is rejected when it is opened. Its size is 128 bytes, so that arrays
+ * following the header are aligned.
+ *
+ * The BASE file of a DoubleArray holds the live values of NUM_KEY and
+ * DA_SIZE in its header. The header of the CHECK file is a copy made when
+ * the double array is closed, and "pair" tells whether two files belong
+ * together.
+ */
+
+#ifndef _MADA_FILE_HEADER_HPP_
+#define _MADA_FILE_HEADER_HPP_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MADA_MAGIC "MaDaDA\0\0"
+#define MADA_VERSION (2) // 2: key ids in leaves, 128 bytes header
+#define MADA_ENDIAN_MARK (0x01020304)
+
+#define MADA_FLAG_CLEAN (1) // closed properly; e_head can be trusted.
+
+namespace mada
+{
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endian; // MADA_ENDIAN_MARK in the byte order of the writer
+    uint16_t index_size; // sizeof(IndexType)
+    uint16_t key_size; // sizeof(KeyType)
+    uint32_t term; // terminal symbol
+    uint32_t max; // the maximal value of KeyType
+    uint32_t checksum; // Checksum() of the arrays, or 0 to skip the check
+    int64_t num_key;
+    int64_t da_size;
+    int64_t e_head; // head of unused element list
+    uint32_t flags;
+    uint32_t pair; // the same random value in BASE and CHECK files
+    int64_t id_limit; // every key id is less than this
+    uint64_t serial; // counts updates of the keys or the layout; never
+                     // goes back, even across Build()
+    char reserved[48];
+};
+
+/*
+ * Fill the header for a double array with the specified parameters.
+ */
+template <class IndexType, class KeyType>
+void InitHeader(FileHeader *h, KeyType term, KeyType max)
+{
+    memset(h, 0, sizeof(FileHeader));
+    memcpy(h->magic, MADA_MAGIC, sizeof(h->magic));
+    h->version = MADA_VERSION;
+    h->endian = MADA_ENDIAN_MARK;
+    h->index_size = sizeof(IndexType);
+    h->key_size = sizeof(KeyType);
+    h->term = term;
+    h->max = max;
+}
+
+/*
+ * Return a new value of "pair". It is read from /dev/urandom, and mixed
+ * with the time, the process id and a counter, so that two double arrays
+ * made in the same second (even by the same process) get different
+ * values.
+ */
+inline uint32_t NewPair()
+{
+    static uint32_t counter = 0;
+    uint32_t r = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+
+    if (fd != -1) {
+	if (read(fd, &r, sizeof(r)) != sizeof(r))
+	    r = 0;
+	close(fd);
+    }
+
+    r ^= time(NULL) ^ (getpid() << 16);
+    r ^= __sync_add_and_fetch(&counter, 1) * 2654435761u;
+
+    return r;
+}
+
+/*
+ * Return 1 if the header was written for a double array with the
+ * specified parameters. Otherwise, return 0. This never reads beyond the
+ * header.
+ */
+template <class IndexType, class KeyType>
+int CheckHeader(const FileHeader *h, KeyType term)
+{
+    return memcmp(h->magic, MADA_MAGIC, sizeof(h->magic)) == 0 &&
+	h->version == MADA_VERSION &&
+	h->endian == MADA_ENDIAN_MARK &&
+	h->index_size == sizeof(IndexType) &&
+	h->key_size == sizeof(KeyType) &&
+	h->term == (uint32_t) term &&
+	h->num_key >= 0 &&
+	h->da_size >= 1 &&
+	h->id_limit >= h->num_key;
+}
+
+/*
+ * FNV-1a hash of "size" bytes, continued from "hash" (2166136261 for the
+ * first block).
+ */
+inline uint32_t Checksum(const void *data, size_t size,
+			 uint32_t hash = 2166136261u)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+
+    for (size_t i = 0; i < size; i++) {
+	hash ^= p[i];
+	hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+}
+
+#endif // _MADA_FILE_HEADER_HPP_
@@ -0,0 +1,320 @@
+/*
+ * KeyFilter.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Blocked Bloom filter over the keys of a double array, in a mapped file
+ * next to the BASE and CHECK files.
+ *
+ * A key is hashed to one block of 64 bytes (a cache line), and sets one
+ * bit in each of the eight 64-bit words of the block. A key that is not
+ * in the double array is rejected by one probe with a probability of
+ * about 99% at 10 bits per key, instead of walking BASE and CHECK:
+ *
+ *   KeyFilter<int, unsigned char> filter(da, "filter");
+ *   if (!filter.IsValid())
+ *       filter.Build(10);
+ *   index = filter.Search(key);
+ *
+ * The file records the "pair", "serial", number of keys and size of the
+ * double array. Add() and Remove() of this class update both the double
+ * array and the filter. Any other update (DoubleArray::Add(), Build(),
+ * Relayout(), Merge(), ...) increases "serial" of the double array and
+ * makes the filter stale, i.e. IsValid() returns 0 and Search() falls
+ * back to the double array until Build(). A bit can't be cleared, so that
+ * removed keys still pass the filter until it is rebuilt.
+ */
+
+#ifndef _MADA_KEY_FILTER_HPP_
+#define _MADA_KEY_FILTER_HPP_
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "MappedArray.hpp"
+#include "DoubleArray.hpp"
+#include "FileHeader.hpp"
+
+#define MADA_FILTER_MAGIC "MaDaBF\0\0"
+#define MADA_FILTER_WORDS (8) // 64-bit words in a block
+
+namespace mada
+{
+struct FilterHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endian; // MADA_ENDIAN_MARK in the byte order of the writer
+    uint32_t pair; // "pair" of the double array at Build()
+    uint32_t bits_per_key;
+    uint64_t serial; // "serial" of the double array after the last update
+    int64_t blocks; // the number of blocks, or 0 before Build()
+    int64_t num_key; // keys of the double array after the last update
+    int64_t da_size; // size of the double array after the last update
+    char reserved[8];
+};
+
+template <class IndexType, class KeyType> class KeyFilter
+{
+private:
+    DoubleArray<IndexType, KeyType> &da;
+    MappedArray<uint64_t> bits;
+
+    FilterHeader *Header()
+    { return static_cast<FilterHeader *>(bits.header()); }
+    const FilterHeader *Header() const
+    { return static_cast<const FilterHeader *>(bits.header()); }
+
+    uint64_t Hash(const KeyType *a) const;
+    void Insert(const KeyType *a);
+    void Update();
+
+    // Copy is forbidden.
+    KeyFilter(const KeyFilter &f);
+    KeyFilter &operator=(const KeyFilter &f);
+public:
+    KeyFilter(DoubleArray<IndexType, KeyType> &da, const char *file);
+    ~KeyFilter();
+
+    int IsValid() const;
+    void Build(int bits_per_key);
+
+    int MayContain(const KeyType *a) const;
+    IndexType Search(const KeyType *a) const;
+    IndexType Add(const KeyType *a, IndexType *id = NULL);
+    IndexType Remove(const KeyType *a);
+};
+
+/*
+ * Open the filter in "file". A new file is empty and stale until Build().
+ *
+ * Exceptions:
+ *   2: The header doesn't match (magic, version or byte order).
+ *   Others: See MappedArray.
+ */
+template <class IndexType, class KeyType>
+KeyFilter<IndexType, KeyType>::KeyFilter(DoubleArray<IndexType, KeyType> &da,
+					 const char *file) :
+    da(da),
+    bits(file, sizeof(FilterHeader))
+{
+    if (Header()->magic[0] == 0) {
+	memcpy(Header()->magic, MADA_FILTER_MAGIC, sizeof(Header()->magic));
+	Header()->version = MADA_VERSION;
+	Header()->endian = MADA_ENDIAN_MARK;
+	return;
+    }
+
+    if (memcmp(Header()->magic, MADA_FILTER_MAGIC, sizeof(Header()->magic)) ||
+	Header()->version != MADA_VERSION ||
+	Header()->endian != MADA_ENDIAN_MARK ||
+	Header()->blocks < 0)
+	throw 2;
+}
+
+template <class IndexType, class KeyType>
+KeyFilter<IndexType, KeyType>::~KeyFilter()
+{
+    // MappedArray needs at least one element after the header.
+    bits.truncate(Header()->blocks ?
+		  Header()->blocks * MADA_FILTER_WORDS : 1);
+}
+
+/*
+ * This method returns 1 if the filter covers the current keys of the
+ * double array. Otherwise, it returns 0.
+ */
+template <class IndexType, class KeyType>
+int KeyFilter<IndexType, KeyType>::IsValid() const
+{
+    return Header()->blocks > 0 &&
+	Header()->pair == da.Header()->pair &&
+	Header()->serial == da.Header()->serial &&
+	Header()->num_key == da.Header()->num_key &&
+	Header()->da_size == da.Header()->da_size;
+}
+
+/*
+ * FNV-1a over the symbols of the key followed by the finalizer of
+ * MurmurHash3, so that every bit of the result depends on every symbol.
+ */
+template <class IndexType, class KeyType>
+uint64_t KeyFilter<IndexType, KeyType>::Hash(const KeyType *a) const
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (; *a != da.term; a++) {
+	h ^= (uint64_t) *a;
+	h *= 1099511628211ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+template <class IndexType, class KeyType>
+void KeyFilter<IndexType, KeyType>::Insert(const KeyType *a)
+{
+    uint64_t h = Hash(a);
+    uint64_t *block = &bits[(((h >> 32) * Header()->blocks) >> 32)
+			    * MADA_FILTER_WORDS];
+
+    // 6 bits of the lower half choose the bit of each word.
+    for (int j = 0; j < MADA_FILTER_WORDS; j++, h = h >> 6 | h << 58)
+	block[j] |= 1ULL << (h & 63);
+}
+
+/*
+ * Record the state of the double array after an update which the filter
+ * follows.
+ */
+template <class IndexType, class KeyType>
+void KeyFilter<IndexType, KeyType>::Update()
+{
+    Header()->serial = da.Header()->serial;
+    Header()->num_key = da.Header()->num_key;
+    Header()->da_size = da.Header()->da_size;
+}
+
+/*
+ * Make the filter for the current keys of the double array, with
+ * "bits_per_key" bits for each key.
+ */
+template <class IndexType, class KeyType>
+void KeyFilter<IndexType, KeyType>::Build(int bits_per_key)
+{
+    if (bits_per_key < 1)
+	bits_per_key = 1;
+
+    uint64_t n = (uint64_t) da.Header()->num_key * bits_per_key;
+    int64_t blocks = (n + MADA_FILTER_WORDS * 64 - 1) /
+	(MADA_FILTER_WORDS * 64);
+
+    if (blocks == 0)
+	blocks = 1;
+
+    bits.clear();
+    bits.expand_to(blocks * MADA_FILTER_WORDS);
+
+    memset(Header(), 0, sizeof(FilterHeader));
+    memcpy(Header()->magic, MADA_FILTER_MAGIC, sizeof(Header()->magic));
+    Header()->version = MADA_VERSION;
+    Header()->endian = MADA_ENDIAN_MARK;
+    Header()->bits_per_key = bits_per_key;
+    Header()->blocks = blocks;
+
+    vector<KeyType> key(16);
+    for (IndexType i = 1; i <= da.Header()->da_size; i++) {
+	if (da.check[i] <= 0 || da.base[i] >= 0)
+	    continue;
+
+	int len = da.Key(i, &key[0], key.size());
+	if (len >= 0 && (size_t) len >= key.size()) {
+	    key.resize(len + 1);
+	    len = da.Key(i, &key[0], key.size());
+	}
+	if (len >= 0)
+	    Insert(&key[0]);
+    }
+
+    Header()->pair = da.Header()->pair;
+    Update();
+}
+
+/*
+ * This method returns 0 if the key is surely not in the double array.
+ * Otherwise, it returns 1. The filter must be valid.
+ *
+ * Argument:
+ *   a: Key to be tested.
+ *      The end of this string must be ended with terminal symbol "term".
+ */
+template <class IndexType, class KeyType>
+int KeyFilter<IndexType, KeyType>::MayContain(const KeyType *a) const
+{
+    uint64_t h = Hash(a);
+    const uint64_t *block = &bits[(((h >> 32) * Header()->blocks) >> 32)
+				  * MADA_FILTER_WORDS];
+    uint64_t miss = 0;
+
+    for (int j = 0; j < MADA_FILTER_WORDS; j++, h = h >> 6 | h << 58)
+	miss |= ~block[j] & (1ULL << (h & 63));
+
+    return miss == 0;
+}
+
+/*
+ * The same as DoubleArray::Search(), except that most keys which are not
+ * in the double array are rejected by the filter. A stale filter is
+ * ignored.
+ */
+template <class IndexType, class KeyType>
+IndexType KeyFilter<IndexType, KeyType>::Search(const KeyType *a) const
+{
+    if (IsValid() && !MayContain(a))
+	return 0;
+
+    return da.Search(a);
+}
+
+/*
+ * Add the key to the double array and to the filter. The return value
+ * and "id" are those of DoubleArray::Add(a, id).
+ */
+template <class IndexType, class KeyType>
+IndexType KeyFilter<IndexType, KeyType>::Add(const KeyType *a, IndexType *id)
+{
+    int valid = IsValid();
+    IndexType ret = da.Add(a, id);
+
+    if (valid) {
+	if (ret > 0)
+	    Insert(a);
+	Update();
+    }
+
+    return ret;
+}
+
+/*
+ * Remove the key from the double array. The filter stays valid, but the
+ * key passes it until Build(). The return value is that of
+ * DoubleArray::Remove().
+ */
+template <class IndexType, class KeyType>
+IndexType KeyFilter<IndexType, KeyType>::Remove(const KeyType *a)
+{
+    int valid = IsValid();
+    IndexType ret = da.Remove(a);
+
+    if (valid)
+	Update();
+
+    return ret;
+}
+
+}
+
+#endif // _MADA_KEY_FILTER_HPP_
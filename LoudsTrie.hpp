@@ -0,0 +1,633 @@
+/*
+ * LoudsTrie.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read-only trie in LOUDS (level-order unary degree sequence) encoding,
+ * for dictionaries which are rarely searched.
+ *
+ * Nodes are numbered in breadth-first order from the root (node 0). Node
+ * i with d children is written as d 1-bits followed by a 0-bit, so that
+ * the children of node i are the nodes rank1(s)+1 ... rank1(s)+d, where
+ * s = select0(i-1)+1 is the start of its bits. The label of the edge
+ * into each node is kept in an array indexed by the node, and a key ends
+ * at the nodes whose bit in the "terminal" bit vector is set. The
+ * terminal symbol is not stored as a node.
+ *
+ * A node costs about 2 bits of LOUDS, one bit of "terminal", one label
+ * and the directories for rank (a count for each 512 bits) and select (a
+ * position for each 256 0-bits), i.e. about 12 bits with 8-bit labels
+ * instead of two cells of BASE and CHECK for each node and leaf.
+ *
+ * The id of each key in the DoubleArray is kept in an array indexed by
+ * the rank of its node in "terminal", packed in as many bits as the
+ * largest id needs, so that Search() returns the same id as
+ * DoubleArray::SearchId() and files of attributes can be used with the
+ * trie. All sections are stored as 64-bit words in one file after a
+ * LoudsHeader. The trie is made from a DoubleArray by Build() and turned
+ * back into one by Restore().
+ */
+
+#ifndef _MADA_LOUDS_TRIE_HPP_
+#define _MADA_LOUDS_TRIE_HPP_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "MappedArray.hpp"
+#include "DoubleArray.hpp"
+#include "FileHeader.hpp"
+
+#define MADA_LOUDS_MAGIC "MaDaLT\0\0"
+#define MADA_LOUDS_VERSION (3) // 3: key ids
+
+namespace mada
+{
+struct LoudsHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endian; // MADA_ENDIAN_MARK in the byte order of the writer
+    uint32_t key_size; // sizeof(KeyType)
+    uint32_t term; // terminal symbol
+    int64_t num_key;
+    int64_t num_node;
+    int64_t louds; // offset of each section in 64-bit words
+    int64_t louds_rank;
+    int64_t louds_select;
+    int64_t terminal;
+    int64_t terminal_rank;
+    int64_t labels;
+    int64_t ids;
+    int64_t size; // the number of words
+    int64_t id_limit; // ID_LIMIT of the double array
+    uint32_t pair; // "pair" of the double array
+    uint32_t id_bits; // bits per id
+    char reserved[8];
+};
+
+template <class KeyType> class LoudsTrie
+{
+private:
+    enum {
+	BLOCK = 512, // bits per count of the rank directory
+	SAMPLE = 256 // 0-bits per position of the select directory
+    };
+
+    // for Restore()
+    struct Frame
+    {
+	uint64_t next; // the next child to visit
+	uint64_t end;
+    };
+
+    MappedArray<uint64_t> unit;
+    KeyType term; // terminal symbol
+
+    LoudsHeader *Header()
+    { return static_cast<LoudsHeader *>(unit.header()); }
+    const LoudsHeader *Header() const
+    { return static_cast<const LoudsHeader *>(unit.header()); }
+    const uint64_t *Words(int64_t offset) const { return &unit[0] + offset; }
+
+    static uint64_t Popcount(uint64_t x);
+    static void PushBit(vector<uint64_t> &bits, uint64_t &n, int bit);
+    static void PushBits(vector<uint64_t> &bits, uint64_t &n, uint64_t value,
+			 int width);
+    static void MakeRank(const vector<uint64_t> &bits, vector<uint64_t> &rank);
+
+    uint64_t Rank1(const uint64_t *bits, const uint64_t *rank,
+		   uint64_t p) const;
+    uint64_t Select0(uint64_t i) const;
+    uint64_t Children(uint64_t node, uint64_t *first) const;
+    int IsTerminal(uint64_t node) const;
+    int64_t Id(uint64_t node) const;
+    KeyType Label(uint64_t node) const
+    { return reinterpret_cast<const KeyType *>(Words(Header()->labels))[node]; }
+
+    // Copy is forbidden.
+    LoudsTrie(const LoudsTrie &t);
+    LoudsTrie &operator=(const LoudsTrie &t);
+public:
+    LoudsTrie(const char *file, KeyType term);
+    ~LoudsTrie();
+
+    template <class IndexType>
+    int64_t Build(const DoubleArray<IndexType, KeyType> &da);
+    template <class IndexType>
+    int64_t Restore(DoubleArray<IndexType, KeyType> &da, int threads) const;
+
+    int64_t Search(const KeyType *a) const;
+    template <class Callback>
+    size_t PrefixSearch(const KeyType *a, Callback &callback) const;
+
+    int64_t NumKey() const { return Header()->num_key; }
+    size_t Bytes() const
+    { return sizeof(LoudsHeader) + Header()->size * sizeof(uint64_t); }
+    void printInfo() const;
+};
+
+/*
+ * Open the trie in "file". A new file is an empty trie.
+ *
+ * Exceptions:
+ *   2: The header doesn't match (magic, version, byte order, KeyType or
+ *      terminal symbol).
+ *   Others: See MappedArray.
+ */
+template <class KeyType>
+LoudsTrie<KeyType>::LoudsTrie(const char *file, KeyType term) :
+    unit(file, sizeof(LoudsHeader)),
+    term(term)
+{
+    if (Header()->magic[0] == 0) {
+	memcpy(Header()->magic, MADA_LOUDS_MAGIC, sizeof(Header()->magic));
+	Header()->version = MADA_LOUDS_VERSION;
+	Header()->endian = MADA_ENDIAN_MARK;
+	Header()->key_size = sizeof(KeyType);
+	Header()->term = term;
+	return;
+    }
+
+    if (memcmp(Header()->magic, MADA_LOUDS_MAGIC, sizeof(Header()->magic)) ||
+	Header()->version != MADA_LOUDS_VERSION ||
+	Header()->endian != MADA_ENDIAN_MARK ||
+	Header()->key_size != sizeof(KeyType) ||
+	Header()->term != (uint32_t) term ||
+	Header()->size < 0)
+	throw 2;
+}
+
+template <class KeyType>
+LoudsTrie<KeyType>::~LoudsTrie()
+{
+    // MappedArray needs at least one element after the header.
+    unit.truncate(Header()->size ? Header()->size : 1);
+}
+
+template <class KeyType>
+inline void LoudsTrie<KeyType>::PushBit(vector<uint64_t> &bits, uint64_t &n,
+					int bit)
+{
+    if (n % 64 == 0)
+	bits.push_back(0);
+    if (bit)
+	bits[n / 64] |= 1ULL << (n % 64);
+    n++;
+}
+
+template <class KeyType>
+inline void LoudsTrie<KeyType>::PushBits(vector<uint64_t> &bits, uint64_t &n,
+					 uint64_t value, int width)
+{
+    for (int i = 0; i < width; i++)
+	PushBit(bits, n, (value >> i) & 1);
+}
+
+/*
+ * Without -mpopcnt, __builtin_popcountll() is a library call, which is
+ * slower than counting in parallel.
+ */
+template <class KeyType>
+inline uint64_t LoudsTrie<KeyType>::Popcount(uint64_t x)
+{
+#ifdef __POPCNT__
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+/*
+ * Make the rank directory of "bits". Each block of 512 bits has two
+ * words: the number of 1-bits before the block, and the numbers of
+ * 1-bits before its words 1 to 7 in 9 bits each. A block is added past
+ * the end, so that the rank of the last bit can be taken.
+ */
+template <class KeyType>
+void LoudsTrie<KeyType>::MakeRank(const vector<uint64_t> &bits,
+				  vector<uint64_t> &rank)
+{
+    const size_t words = BLOCK / 64;
+    uint64_t ones = 0;
+
+    rank.clear();
+    for (size_t w = 0; w <= bits.size() / words * words; w += words) {
+	uint64_t sub = 0, count = 0;
+
+	for (size_t k = 0; k < words; k++) {
+	    if (k > 0)
+		sub |= count << (9 * (k-1));
+	    if (w + k < bits.size())
+		count += Popcount(bits[w + k]);
+	}
+
+	rank.push_back(ones);
+	rank.push_back(sub);
+	ones += count;
+    }
+}
+
+/*
+ * The number of 1-bits in [0, p).
+ */
+template <class KeyType>
+inline uint64_t LoudsTrie<KeyType>::Rank1(const uint64_t *bits,
+					  const uint64_t *rank,
+					  uint64_t p) const
+{
+    uint64_t w = p / 64;
+    uint64_t k = w % (BLOCK / 64);
+    uint64_t r = rank[p / BLOCK * 2];
+
+    if (k > 0)
+	r += (rank[p / BLOCK * 2 + 1] >> (9 * (k-1))) & 0x1ff;
+    if (p % 64)
+	r += Popcount(bits[w] << (64 - p % 64));
+
+    return r;
+}
+
+/*
+ * The position of the 0-bit of LOUDS whose number is "i" (from 0).
+ *
+ * The sample of the select directory gives the block to start from, and
+ * the rank directory skips whole blocks and words.
+ */
+template <class KeyType>
+uint64_t LoudsTrie<KeyType>::Select0(uint64_t i) const
+{
+    const uint64_t *bits = Words(Header()->louds);
+    const uint64_t *rank = Words(Header()->louds_rank);
+    uint64_t blocks = (Header()->louds_select - Header()->louds_rank) / 2;
+    uint64_t b = Words(Header()->louds_select)[i / SAMPLE] / BLOCK;
+
+    // 0-bits before block b+1 is b+1 blocks minus their 1-bits
+    while (b + 1 < blocks && (b+1) * BLOCK - rank[(b+1) * 2] <= i)
+	b++;
+
+    uint64_t left = i - (b * BLOCK - rank[b * 2]);
+    uint64_t w = b * (BLOCK / 64);
+
+    for (uint64_t k = 7; k > 0; k--) {
+	uint64_t zeros = k * 64 - ((rank[b * 2 + 1] >> (9 * (k-1))) & 0x1ff);
+
+	if (zeros <= left) {
+	    w += k;
+	    left -= zeros;
+	    break;
+	}
+    }
+
+    // Clear the lower 0-bits of the word, then take the lowest one left.
+    uint64_t zeros = ~bits[w];
+
+    while (left--)
+	zeros &= zeros - 1;
+
+    return w * 64 + __builtin_ctzll(zeros);
+}
+
+/*
+ * Return the number of children of "node", and store the number of its
+ * first child to "*first".
+ */
+template <class KeyType>
+inline uint64_t LoudsTrie<KeyType>::Children(uint64_t node,
+					     uint64_t *first) const
+{
+    const uint64_t *bits = Words(Header()->louds);
+    uint64_t s = node ? Select0(node - 1) + 1 : 0;
+
+    *first = Rank1(bits, Words(Header()->louds_rank), s) + 1;
+
+    // count 1-bits up to the next 0-bit
+    for (uint64_t p = s; ; p += 64 - p % 64) {
+	uint64_t zeros = ~bits[p / 64] >> (p % 64);
+
+	if (zeros)
+	    return p + __builtin_ctzll(zeros) - s;
+    }
+}
+
+template <class KeyType>
+inline int LoudsTrie<KeyType>::IsTerminal(uint64_t node) const
+{
+    return (Words(Header()->terminal)[node / 64] >> (node % 64)) & 1;
+}
+
+/*
+ * The key id of a terminal node. The ids are packed in "id_bits" bits
+ * each, so an id may span two words.
+ */
+template <class KeyType>
+inline int64_t LoudsTrie<KeyType>::Id(uint64_t node) const
+{
+    uint64_t width = Header()->id_bits;
+
+    if (width == 0)
+	return 0;
+
+    const uint64_t *ids = Words(Header()->ids);
+    uint64_t p = Rank1(Words(Header()->terminal),
+		       Words(Header()->terminal_rank), node) * width;
+    uint64_t id = ids[p / 64] >> (p % 64);
+
+    if (p % 64 + width > 64)
+	id |= ids[p / 64 + 1] << (64 - p % 64);
+    if (width < 64)
+	id &= (1ULL << width) - 1;
+
+    return id;
+}
+
+/*
+ * This method replaces the content of this trie with all keys stored in
+ * the specified double array, and returns the number of keys.
+ *
+ * Exceptions:
+ *   1: "da" has another terminal symbol.
+ *   Others: See MappedArray.
+ */
+template <class KeyType>
+template <class IndexType>
+int64_t LoudsTrie<KeyType>::Build(const DoubleArray<IndexType, KeyType> &da)
+{
+    if (da.term != term)
+	throw 1;
+
+    vector<IndexType> queue(1, 1);
+    vector<uint64_t> louds, terminal, louds_rank, terminal_rank, select, ids;
+    vector<KeyType> labels(1, 0); // the root has no label
+    vector<KeyType> children(da.max);
+    uint64_t bits = 0, zeros = 0, id_bits = 0;
+    int64_t keys = 0;
+    int width = 0;
+
+    while (width < 64 && (1ULL << width) < (uint64_t) da.Header()->id_limit)
+	width++;
+
+    for (size_t head = 0; head < queue.size(); head++) {
+	IndexType s = queue[head];
+	size_t n = da.GetChildren(s, &children[0]);
+
+	if (terminal.size() <= head / 64)
+	    terminal.push_back(0);
+
+	for (size_t i = 0; i < n; i++) {
+	    if (children[i] == term) {
+		terminal[head / 64] |= 1ULL << (head % 64);
+		PushBits(ids, id_bits, da.Id(da.base[s] + term), width);
+		keys++;
+	    } else {
+		PushBit(louds, bits, 1);
+		queue.push_back(da.base[s] + children[i]);
+		labels.push_back(children[i]);
+	    }
+	}
+
+	if (zeros++ % SAMPLE == 0)
+	    select.push_back(bits);
+	PushBit(louds, bits, 0);
+    }
+
+    MakeRank(louds, louds_rank);
+    MakeRank(terminal, terminal_rank);
+
+    size_t label_words = (labels.size() * sizeof(KeyType) + 7) / 8;
+    int64_t offset[8];
+
+    offset[0] = 0;
+    offset[1] = offset[0] + louds.size();
+    offset[2] = offset[1] + louds_rank.size();
+    offset[3] = offset[2] + select.size();
+    offset[4] = offset[3] + terminal.size();
+    offset[5] = offset[4] + terminal_rank.size();
+    offset[6] = offset[5] + label_words;
+    offset[7] = offset[6] + ids.size();
+
+    unit.clear();
+    unit.expand_to(offset[7]);
+
+    copy(louds.begin(), louds.end(), &unit[offset[0]]);
+    copy(louds_rank.begin(), louds_rank.end(), &unit[offset[1]]);
+    copy(select.begin(), select.end(), &unit[offset[2]]);
+    copy(terminal.begin(), terminal.end(), &unit[offset[3]]);
+    copy(terminal_rank.begin(), terminal_rank.end(), &unit[offset[4]]);
+    memset(&unit[offset[5]], 0, label_words * sizeof(uint64_t));
+    memcpy(&unit[offset[5]], &labels[0], labels.size() * sizeof(KeyType));
+    copy(ids.begin(), ids.end(), &unit[offset[6]]);
+
+    memset(Header(), 0, sizeof(LoudsHeader));
+    memcpy(Header()->magic, MADA_LOUDS_MAGIC, sizeof(Header()->magic));
+    Header()->version = MADA_LOUDS_VERSION;
+    Header()->endian = MADA_ENDIAN_MARK;
+    Header()->key_size = sizeof(KeyType);
+    Header()->term = term;
+    Header()->num_key = keys;
+    Header()->num_node = queue.size();
+    Header()->louds = offset[0];
+    Header()->louds_rank = offset[1];
+    Header()->louds_select = offset[2];
+    Header()->terminal = offset[3];
+    Header()->terminal_rank = offset[4];
+    Header()->labels = offset[5];
+    Header()->ids = offset[6];
+    Header()->size = offset[7];
+    Header()->id_limit = da.Header()->id_limit;
+    Header()->pair = da.Header()->pair;
+    Header()->id_bits = width;
+
+    return keys;
+}
+
+/*
+ * This method replaces the content of "da" with all keys of this trie
+ * by DoubleArray::Build(), and returns the number of keys. The ids of the
+ * keys, ID_LIMIT and "pair" of the double array which the trie was built
+ * from are kept, so that files of attributes stay valid (as Relayout()
+ * keeps them). "serial" is increased.
+ */
+template <class KeyType>
+template <class IndexType>
+int64_t LoudsTrie<KeyType>::Restore(DoubleArray<IndexType, KeyType> &da,
+				    int threads) const
+{
+    vector<KeyType> pool;
+    vector<size_t> offsets;
+    vector<int64_t> ids;
+    vector<Frame> stack;
+    vector<KeyType> key;
+
+    if (NumKey()) {
+	Frame root;
+	root.end = Children(0, &root.next);
+	root.end += root.next;
+	stack.push_back(root);
+
+	if (IsTerminal(0)) {
+	    offsets.push_back(pool.size());
+	    ids.push_back(Id(0));
+	    pool.push_back(term);
+	}
+    }
+
+    while (!stack.empty()) {
+	Frame &f = stack.back();
+
+	if (f.next == f.end) {
+	    stack.pop_back();
+	    if (!key.empty())
+		key.pop_back();
+	    continue;
+	}
+
+	uint64_t node = f.next++;
+	Frame child;
+
+	key.push_back(Label(node));
+	if (IsTerminal(node)) {
+	    offsets.push_back(pool.size());
+	    ids.push_back(Id(node));
+	    pool.insert(pool.end(), key.begin(), key.end());
+	    pool.push_back(term);
+	}
+
+	child.end = Children(node, &child.next);
+	child.end += child.next;
+	stack.push_back(child);
+    }
+
+    vector<const KeyType *> keys(offsets.size());
+    for (size_t i = 0; i < offsets.size(); i++)
+	keys[i] = &pool[offsets[i]];
+
+    int64_t count = da.Build(keys, threads);
+
+    // Build() gives ids in the order of keys; put back the stored ones.
+    for (size_t i = 0; i < keys.size(); i++)
+	da.base[da.Search(keys[i])] = -(IndexType) ids[i] - 1;
+
+    da.Header()->id_limit = Header()->id_limit;
+    da.Header()->pair = Header()->pair;
+    da.HeaderOfCheck()->pair = Header()->pair;
+    da.free_ids.clear();
+    da.free_ids_valid = da.Header()->id_limit == da.Header()->num_key;
+
+    return count;
+}
+
+/*
+ * This method check if a key is included in this trie. If the specified
+ * key is found, this method returns its id, the same as
+ * DoubleArray::SearchId() of the double array which the trie was built
+ * from. Otherwise, it returns -1.
+ *
+ * Argument:
+ *   a: Key to be searched.
+ *      The end of this string must be ended with terminal symbol "term".
+ */
+template <class KeyType>
+int64_t LoudsTrie<KeyType>::Search(const KeyType *a) const
+{
+    if (!NumKey())
+	return -1;
+
+    uint64_t node = 0;
+
+    for (size_t pos = 0; a[pos] != term; pos++) {
+	uint64_t first;
+	uint64_t n = Children(node, &first);
+	uint64_t i;
+
+	for (i = 0; i < n && Label(first + i) < a[pos]; i++)
+	    ;
+	if (i == n || Label(first + i) != a[pos])
+	    return -1;
+
+	node = first + i;
+    }
+
+    if (!IsTerminal(node))
+	return -1;
+
+    return Id(node);
+}
+
+/*
+ * This method finds all keys which are prefixes of the specified key, and
+ * returns the number of such keys. For each key found from the shortest,
+ * callback(len, id) is called, where "len" is the length of the key
+ * and "id" is the value which Search() returns for it.
+ *
+ * Argument:
+ *   a: Key to be searched.
+ *      The end of this string must be ended with terminal symbol "term".
+ */
+template <class KeyType>
+template <class Callback>
+size_t LoudsTrie<KeyType>::PrefixSearch(const KeyType *a,
+					Callback &callback) const
+{
+    if (!NumKey())
+	return 0;
+
+    uint64_t node = 0;
+    size_t count = 0;
+
+    for (size_t pos = 0; ; pos++) {
+	if (IsTerminal(node)) {
+	    callback(pos, Id(node));
+	    count++;
+	}
+
+	if (a[pos] == term)
+	    return count;
+
+	uint64_t first;
+	uint64_t n = Children(node, &first);
+	uint64_t i;
+
+	for (i = 0; i < n && Label(first + i) < a[pos]; i++)
+	    ;
+	if (i == n || Label(first + i) != a[pos])
+	    return count;
+
+	node = first + i;
+    }
+}
+
+template <class KeyType>
+void LoudsTrie<KeyType>::printInfo() const
+{
+    printf ("Size of trie: %lu bytes (%.1f bits per node)\n",
+	    (unsigned long) Bytes(),
+	    Header()->num_node ? Bytes() * 8.0 / Header()->num_node : 0.0);
+    printf ("The number of nodes: %lld\n", (long long) Header()->num_node);
+    printf ("The number of keys: %lld\n", (long long) Header()->num_key);
+}
+
+}
+
+#endif // _MADA_LOUDS_TRIE_HPP_
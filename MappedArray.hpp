@@ -35,6 +35,7 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <vector>
 
 namespace mada
 {
@@ -42,42 +43,69 @@ template <class T> class MappedArray
 {
 private:
     T* array;
+    char *map; // the beginning of the mapping, i.e. the header
+    size_t header_size;
     int fd;
     size_t mapped_size;
 //    size_t size;
 
+    size_t bytes() { return header_size + mapped_size * sizeof(T); }
+
     // Copy is forbidden.
     MappedArray(const MappedArray &a);
     MappedArray &operator=(const MappedArray &a);
 
     void resize(size_t new_size) throw (int);
 public:
-    MappedArray(const char *filename) throw (int);
+    MappedArray(const char *filename, size_t header_size = 0) throw (int);
     ~MappedArray() throw (int);
 
+    void *header() { return map; }
+    const void *header() const { return map; }
+    size_t size() const { return mapped_size; } // the number of elements
+
     void expand_to(size_t size) throw (int);
     void clear() throw (int);
     void truncate(size_t size) throw (int);
     T &operator[](size_t i) throw (int);
+    const T &operator[](size_t i) const throw (int) { return array[i]; }
+
+    // page residency of the mapping
+    static size_t page_size() { return sysconf(_SC_PAGESIZE); }
+    size_t page_of(size_t i) const
+    { return (header_size + i * sizeof(T)) / page_size(); }
+    size_t pages() const
+    { return (header_size + mapped_size * sizeof(T) + page_size() - 1)
+	    / page_size(); }
+    size_t resident(std::vector<unsigned char> &vec) const throw (int);
+    void prefault(size_t first, size_t last) const;
 };
 
+/*
+ * Map the specified file as an array. If "header_size" is not 0, the file
+ * begins with a header of "header_size" bytes, which can be accessed by
+ * header(), and the array follows it.
+ */
 template <class T>
-MappedArray<T>::MappedArray (const char *filename) throw (int)
+MappedArray<T>::MappedArray (const char *filename, size_t header_size) throw (int)
 {
     struct stat st;
 
+    this->header_size = header_size;
+
     if (stat(filename, &st) != 0 || st.st_size == 0) {
         // The specified file doesn't exist. Create a new file.
 
         if ((fd = open(filename, O_RDWR | O_CREAT, 0666)) == -1)
             throw 1; // Failed to create the specified file.
 
-        if (lseek(fd, INITIAL_MAPPED_SIZE * sizeof(T), SEEK_SET) < 0) {
+        if (lseek(fd, header_size + INITIAL_MAPPED_SIZE * sizeof(T),
+                  SEEK_SET) < 0) {
             close(fd);
             throw 2; // Failed to expand the file size.
         }
 
-        T c;
+        T c = 0;
         if (read(fd, &c, sizeof(T)) == -1)
             c = 0;
 
@@ -91,27 +119,31 @@ MappedArray<T>::MappedArray (const char *filename) throw (int)
     } else {
         // Open the existing file as an array.
 
+        if ((size_t) st.st_size < header_size + sizeof(T))
+            throw 6; // The file is too small to have the header.
+
 //	mapped_size = size = st.st_size / sizeof(T);
-	mapped_size = st.st_size / sizeof(T);
+	mapped_size = (st.st_size - header_size) / sizeof(T);
         if ((fd = open(filename, O_RDWR)) == -1)
             throw 4; // Failed to open the specified file.
     }
 
-    array = (T*) mmap(NULL, mapped_size * sizeof(T), PROT_READ | PROT_WRITE,
-                      MAP_SHARED, fd, 0);
-    if (array == MAP_FAILED) {
+    map = (char *) mmap(NULL, bytes(), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
         close(fd);
         throw 5; // Failed to map the specified file to an array.
     }
+    array = (T *) (map + header_size);
 }
 
 template <class T>
 MappedArray<T>::~MappedArray() throw (int)
 {
-    if (msync(array, mapped_size * sizeof(T), 0) == -1)
+    if (msync(map, bytes(), 0) == -1)
         throw 1; // Failed to write the content of array to file.
 
-    if (munmap(array, mapped_size * sizeof(T)) == -1)
+    if (munmap(map, bytes()) == -1)
         throw 2; // Failed to release the allocated array.
 
     if (close(fd) == -1)
@@ -121,23 +153,24 @@ MappedArray<T>::~MappedArray() throw (int)
 template <class T>
 void MappedArray<T>::truncate(size_t size) throw (int)
 {
-    if (ftruncate(fd, size * sizeof(T)) == -1)
+    if (ftruncate(fd, header_size + size * sizeof(T)) == -1)
 	throw 1; // Failed to truncate the file size.
 }
 
 template <class T>
 void MappedArray<T>::clear() throw (int)
 {
-    if (munmap (array, mapped_size * sizeof(T)) == -1)
+    if (munmap (map, bytes()) == -1)
         throw 1; // Failed to release the allocated array.
 
     if (ftruncate (fd, 0) == -1)
         throw 2; // Failed to truncate the file size.
 
-    if (lseek (fd, INITIAL_MAPPED_SIZE * sizeof(T), SEEK_SET) < 0)
+    if (lseek (fd, header_size + INITIAL_MAPPED_SIZE * sizeof(T),
+               SEEK_SET) < 0)
         throw 3; // Failed to expand the file size.
 
-    T c;
+    T c = 0;
     if (read (fd, &c, sizeof(T)) == -1)
         c = 0;
 
@@ -147,10 +180,11 @@ void MappedArray<T>::clear() throw (int)
     mapped_size = INITIAL_MAPPED_SIZE;
 //    size = 0;
 
-    array = (T *) mmap(NULL, mapped_size * sizeof(T), PROT_READ | PROT_WRITE,
-                       MAP_SHARED, fd, 0);
-    if (array == MAP_FAILED)
+    map = (char *) mmap(NULL, bytes(), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
         throw 5; // Failed to map the specified file to an array.
+    array = (T *) (map + header_size);
 }
 
 template <class T>
@@ -159,32 +193,33 @@ inline void MappedArray<T>::resize(size_t new_size) throw (int)
     if (mapped_size >= new_size)
         return;
 
-    if (msync (array, mapped_size * sizeof(T), 0) == -1)
+    if (msync (map, bytes(), 0) == -1)
         throw 1; // Failed to write the content of array to file.
 
-    if (munmap (array, mapped_size * sizeof(T)) == -1)
+    if (munmap (map, bytes()) == -1)
         throw 2; // Failed to release the allocated array.
 
     while (mapped_size < new_size)
         mapped_size += RESIZE_SIZE;
 
-    if (lseek (fd, mapped_size * sizeof(T), SEEK_SET) < 0)
+    if (lseek (fd, bytes(), SEEK_SET) < 0)
         throw 3; // Failed to expand the file size.
     // Note that: this makes sure that the new allocated memories
     //            are initialized by 0.
 
-    T c;
+    T c = 0; // read() returns 0 at the end of the file
     if (read(fd, &c, sizeof(T)) == -1)
         c = 0;
 
     if (write(fd, &c, sizeof(T)) == -1)
         throw 4; // Failed to write a new value.
 
-    array = (T *) mmap(NULL, mapped_size * sizeof(T), PROT_READ | PROT_WRITE,
-                       MAP_SHARED, fd, 0);
+    map = (char *) mmap(NULL, bytes(), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
 
-    if (array == MAP_FAILED)
+    if (map == MAP_FAILED)
         throw 5; // Failed to remap the specified file to an array.
+    array = (T *) (map + header_size);
 }
 
 template <class T>
@@ -216,6 +251,50 @@ T &MappedArray<T>::operator[] (size_t i) throw (int)
     return array[i];
 }
 
+/*
+ * Set vec[p] to 1 if page p of the mapping is in memory, and 0
+ * otherwise. The return value is the number of pages in memory.
+ */
+template <class T>
+size_t MappedArray<T>::resident(std::vector<unsigned char> &vec) const throw (int)
+{
+    size_t count = 0;
+
+    vec.resize(pages());
+    if (mincore(map, header_size + mapped_size * sizeof(T), &vec[0]) == -1)
+	throw 1; // Failed to get the residency of the mapping.
+
+    for (size_t p = 0; p < vec.size(); p++) {
+	vec[p] &= 1;
+	count += vec[p];
+    }
+
+    return count;
+}
+
+/*
+ * Read pages from "first" to "last" of the mapping into memory, so that
+ * later accesses don't wait for the disk or take a page fault.
+ */
+template <class T>
+void MappedArray<T>::prefault(size_t first, size_t last) const
+{
+    size_t page = page_size();
+
+    if (last >= pages())
+	last = pages() - 1;
+    if (first > last)
+	return;
+
+    // Read ahead the whole range, then map each page by reading a byte.
+    madvise(map + first * page, (last - first + 1) * page, MADV_WILLNEED);
+
+    volatile char c;
+    for (size_t p = first; p <= last; p++)
+	c = map[p * page];
+    (void) c;
+}
+
 }
 
 #endif // _MADA_MAPPED_ARRAY_HPP_
@@ -0,0 +1,220 @@
+/*
+ * MappedWordList.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Word list (one key per line) mapped to memory.
+ *
+ * The file is mapped privately and each line is returned in place,
+ * terminated by the terminal symbol instead of '\n'. Lines are found with
+ * memchr(), so there is no limit of the length of a line and no copy of
+ * a key is made. When the terminal symbol is not '\n', it is written over
+ * '\n' in the private mapping, which never changes the file.
+ *
+ * When KeyType is wider than a byte, each byte of the file is converted
+ * to one KeyType when the file is opened, and lines are returned in place
+ * in that copy. Either way, a returned line is valid until the list is
+ * destroyed.
+ */
+
+#ifndef _MADA_MAPPED_WORD_LIST_HPP_
+#define _MADA_MAPPED_WORD_LIST_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace mada
+{
+template <class KeyType> class MappedWordList
+{
+private:
+    unsigned char *map; // the private mapping of the file
+    KeyType *data; // the lines (the mapping itself if KeyType is a byte)
+    size_t size; // the number of symbols in "data"
+    size_t pos;
+    KeyType term;
+
+    // The file converted to KeyType, followed by room for a terminal
+    // symbol. It is empty if KeyType is a byte.
+    std::vector<KeyType> wide;
+
+    // The last line when it is not ended with '\n' and there is no room
+    // for the terminal symbol after it.
+    std::vector<KeyType> last;
+
+    // Copy is forbidden.
+    MappedWordList(const MappedWordList &l);
+    MappedWordList &operator=(const MappedWordList &l);
+
+    static KeyType *FindNewline(KeyType *line, size_t n);
+public:
+    MappedWordList(const char *filename, KeyType term);
+    ~MappedWordList();
+
+    const KeyType *Next(size_t *len);
+    const KeyType *Next(size_t *len, unsigned long long *count);
+};
+
+template <class KeyType>
+MappedWordList<KeyType>::MappedWordList(const char *filename, KeyType term)
+{
+    struct stat st;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) == -1)
+	throw 1; // Failed to open the specified file.
+
+    if (fstat(fd, &st) != 0) {
+	close(fd);
+	throw 2; // Failed to get the file size.
+    }
+
+    this->map = NULL;
+    this->data = NULL;
+    this->size = st.st_size;
+    this->pos = 0;
+    this->term = term;
+
+    if (size > 0) {
+	map = (unsigned char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+				     MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+	    close(fd);
+	    throw 3; // Failed to map the specified file.
+	}
+
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	if (sizeof(KeyType) == 1) {
+	    data = (KeyType *) map;
+	} else {
+	    wide.assign(map, map + size);
+	    wide.push_back(0);
+	    data = &wide[0];
+
+	    munmap(map, size);
+	    map = NULL;
+	}
+    }
+
+    close(fd);
+}
+
+template <class KeyType>
+MappedWordList<KeyType>::~MappedWordList()
+{
+    if (map)
+	munmap(map, size);
+}
+
+template <class KeyType>
+inline KeyType *MappedWordList<KeyType>::FindNewline(KeyType *line, size_t n)
+{
+    if (sizeof(KeyType) == 1)
+	return (KeyType *) memchr(line, '\n', n);
+
+    KeyType *nl = std::find(line, line + n, (KeyType) '\n');
+
+    return nl == line + n ? NULL : nl;
+}
+
+/*
+ * This method returns the next line ended with the terminal symbol, and
+ * stores its length (without the terminal symbol) to "len". It returns
+ * NULL at the end of file.
+ */
+template <class KeyType>
+const KeyType *MappedWordList<KeyType>::Next(size_t *len)
+{
+    if (pos >= size)
+	return NULL;
+
+    KeyType *line = data + pos;
+    KeyType *nl = FindNewline(line, size - pos);
+
+    if (nl) {
+	*len = nl - line;
+	pos += *len + 1;
+
+	if (term != '\n')
+	    *nl = term;
+
+	return line;
+    }
+
+    // The last line is not ended with '\n'.
+    *len = size - pos;
+    pos = size;
+
+    if (!wide.empty() || size % sysconf(_SC_PAGESIZE)) {
+	// There is room after the last line: the end of "wide", or the rest
+	// of the last page, which is mapped and filled with 0.
+	line[*len] = term;
+	return line;
+    }
+
+    last.assign(line, line + *len);
+    last.push_back(term);
+
+    return &last[0];
+}
+
+/*
+ * Same as Next(size_t *len), but a line may begin with a count and a tab
+ * character, as in a key-frequency log ("3\tfoo" stands for three lines
+ * of "foo"). The count is stored to "count" and removed from the line.
+ * A line without a count counts 1.
+ */
+template <class KeyType>
+const KeyType *MappedWordList<KeyType>::Next(size_t *len,
+					     unsigned long long *count)
+{
+    const KeyType *line = Next(len);
+
+    if (!line)
+	return NULL;
+
+    size_t i = 0;
+    while (i < *len && '0' <= line[i] && line[i] <= '9')
+	i++;
+
+    *count = 1;
+    if (0 < i && i < *len && line[i] == '\t') {
+	*count = 0;
+	for (size_t j = 0; j < i; j++)
+	    *count = *count * 10 + (line[j] - '0');
+
+	line += i + 1;
+	*len -= i + 1;
+    }
+
+    return line;
+}
+
+}
+
+#endif // _MADA_MAPPED_WORD_LIST_HPP_
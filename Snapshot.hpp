@@ -0,0 +1,360 @@
+/*
+ * Snapshot.hpp
+ * Copyright (C) 2009 Takashi Nakamoto <bluedwarf@bpost.plala.or.jp>.
+ *
+ * This program is part of MaDa Double Array library.
+ *
+ * MaDa Double Array library is free software: you can redistribute it
+ * and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * MaDa Double Array library is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with MaDa Double Array library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read-only snapshots of a double array and their hot reload.
+ *
+ * A snapshot file is written by DoubleArray::WriteSnapshot(). It consists
+ * of a FileHeader, the BASE array and the CHECK array (both from index 0
+ * to DA_SIZE). The file is written under a temporary name and renamed, so
+ * that a snapshot file is always complete. The same image can also be a
+ * section of a Container, which is used in place.
+ *
+ * SnapshotHolder publishes one snapshot to reader threads:
+ *
+ *   reader:    const Snapshot<int, unsigned char> *s = holder.Acquire();
+ *              ... s->Search(key) ...
+ *              holder.Release(s);
+ *
+ *   publisher: holder.Publish("dict.snap");
+ *
+ * Publish() maps and validates the new file before it takes the lock,
+ * and holds the lock only to swap the pointer. Readers hold the lock only
+ * to take a reference. The old snapshot is unmapped by whichever thread
+ * releases its last reference, i.e. after all in-flight lookups finish.
+ */
+
+#ifndef _MADA_SNAPSHOT_HPP_
+#define _MADA_SNAPSHOT_HPP_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
+#include "FileHeader.hpp"
+
+namespace mada
+{
+template <class IndexType, class KeyType> class SnapshotHolder;
+
+template <class IndexType, class KeyType> class Snapshot
+{
+    friend class SnapshotHolder<IndexType, KeyType>;
+
+private:
+    void *map; // NULL if the image is not mapped by this snapshot
+    size_t map_size;
+    const FileHeader *header;
+    const IndexType *base;
+    const IndexType *check;
+    KeyType term;
+
+    mutable int refs; // references from SnapshotHolder and its readers
+
+    void Attach(const void *data, size_t size, KeyType term, int verify);
+
+    // Copy is forbidden.
+    Snapshot(const Snapshot &s);
+    Snapshot &operator=(const Snapshot &s);
+public:
+    Snapshot(const char *filename, KeyType term, int verify);
+    Snapshot(const void *data, size_t size, KeyType term, int verify);
+    ~Snapshot();
+
+    IndexType Search(const KeyType *a) const;
+    IndexType Id(IndexType index) const;
+    int Key(IndexType index, KeyType *buf, size_t size) const;
+    IndexType NumKey() const { return header->num_key; }
+    IndexType Size() const { return header->da_size; }
+};
+
+/*
+ * Map the specified snapshot file. If "verify" is not 0, the checksum of
+ * the arrays is also verified, which reads the whole file.
+ *
+ * Exceptions:
+ *   1: Failed to open the specified file.
+ *   2: The file is smaller than its header says.
+ *   3: Failed to map the file.
+ *   4: The header doesn't match (magic, version, byte order, IndexType,
+ *      KeyType or terminal symbol).
+ *   5: The checksum doesn't match.
+ */
+template <class IndexType, class KeyType>
+Snapshot<IndexType, KeyType>::Snapshot(const char *filename,
+				       KeyType term,
+				       int verify) :
+    refs(1)
+{
+    struct stat st;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) == -1)
+	throw 1;
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(FileHeader)) {
+	close(fd);
+	throw 2;
+    }
+
+    map_size = st.st_size;
+    map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+	throw 3;
+
+    try {
+	Attach(map, map_size, term, verify);
+    } catch (int e) {
+	munmap(map, map_size);
+	throw e;
+    }
+}
+
+/*
+ * Use a snapshot image of "size" bytes at "data", e.g. a section of a
+ * Container. Nothing is mapped, and the memory must stay valid while
+ * this snapshot is used.
+ *
+ * Exceptions:
+ *   2: "size" doesn't match the header.
+ *   4, 5: The same as above.
+ */
+template <class IndexType, class KeyType>
+Snapshot<IndexType, KeyType>::Snapshot(const void *data, size_t size,
+				       KeyType term, int verify) :
+    map(NULL),
+    map_size(0),
+    refs(1)
+{
+    if (size < sizeof(FileHeader))
+	throw 2;
+
+    Attach(data, size, term, verify);
+}
+
+template <class IndexType, class KeyType>
+void Snapshot<IndexType, KeyType>::Attach(const void *data, size_t size,
+					  KeyType term, int verify)
+{
+    header = static_cast<const FileHeader *>(data);
+    if (!CheckHeader<IndexType, KeyType>(header, term))
+	throw 4;
+
+    size_t n = header->da_size + 1;
+    if (size != sizeof(FileHeader) + 2 * n * sizeof(IndexType))
+	throw 2;
+
+    base = reinterpret_cast<const IndexType *>(header + 1);
+    check = base + n;
+    this->term = term;
+
+    if (verify && header->checksum &&
+	Checksum(base, 2 * n * sizeof(IndexType)) != header->checksum)
+	throw 5;
+}
+
+template <class IndexType, class KeyType>
+Snapshot<IndexType, KeyType>::~Snapshot()
+{
+    if (map)
+	munmap(map, map_size);
+}
+
+/*
+ * This method check if a key is included in this snapshot. See
+ * DoubleArray::Search().
+ */
+template <class IndexType, class KeyType>
+IndexType Snapshot<IndexType, KeyType>::Search(const KeyType *a) const
+{
+    if (!header->num_key)
+	return 0;
+
+    IndexType da_size = header->da_size;
+    IndexType index = 1;
+    size_t pos = 0;
+
+    do {
+	IndexType t = base[index] + a[pos];
+
+	if (t <= 0 || t > da_size || check[t] != index)
+	    return 0;
+
+	index = t;
+	pos++;
+    } while (base[index] >= 0);
+
+    return index;
+}
+
+/*
+ * Return the id of the key whose leaf is "index", or -1 if "index" is not
+ * a leaf. See DoubleArray::Id().
+ */
+template <class IndexType, class KeyType>
+IndexType Snapshot<IndexType, KeyType>::Id(IndexType index) const
+{
+    if (index <= 0 || index > header->da_size || check[index] <= 0 ||
+	base[index] >= 0)
+	return -1;
+
+    return -base[index] - 1;
+}
+
+/*
+ * Restore the key of a leaf into "buf". See DoubleArray::Key().
+ */
+template <class IndexType, class KeyType>
+int Snapshot<IndexType, KeyType>::Key(IndexType index, KeyType *buf,
+				      size_t size) const
+{
+    if (Id(index) < 0)
+	return -1;
+
+    size_t n = 0;
+    for (IndexType t = index; t != 1; n++) {
+	IndexType s = check[t];
+
+	if (s <= 0 || base[s] <= 0 || n > (size_t) header->da_size)
+	    return -1; // broken link
+
+	if (n < size)
+	    buf[n] = t - base[s];
+	t = s;
+    }
+
+    if (n <= size)
+	std::reverse(buf, buf + n);
+
+    return n - 1;
+}
+
+template <class IndexType, class KeyType> class SnapshotHolder
+{
+private:
+    Snapshot<IndexType, KeyType> *current;
+    pthread_rwlock_t lock;
+    KeyType term;
+
+    // Copy is forbidden.
+    SnapshotHolder(const SnapshotHolder &h);
+    SnapshotHolder &operator=(const SnapshotHolder &h);
+public:
+    SnapshotHolder(KeyType term);
+    ~SnapshotHolder();
+
+    void Publish(const char *filename);
+    const Snapshot<IndexType, KeyType> *Acquire();
+    void Release(const Snapshot<IndexType, KeyType> *s);
+
+    IndexType Search(const KeyType *a);
+};
+
+template <class IndexType, class KeyType>
+SnapshotHolder<IndexType, KeyType>::SnapshotHolder(KeyType term) :
+    current(NULL),
+    term(term)
+{
+    pthread_rwlock_init(&lock, NULL);
+}
+
+template <class IndexType, class KeyType>
+SnapshotHolder<IndexType, KeyType>::~SnapshotHolder()
+{
+    if (current)
+	Release(current);
+
+    pthread_rwlock_destroy(&lock);
+}
+
+/*
+ * Replace the current snapshot with the specified snapshot file. The file
+ * is validated (including its checksum) before readers can see it. If it
+ * is invalid, an exception from Snapshot is thrown and the current
+ * snapshot stays.
+ */
+template <class IndexType, class KeyType>
+void SnapshotHolder<IndexType, KeyType>::Publish(const char *filename)
+{
+    Snapshot<IndexType, KeyType> *s, *old;
+
+    s = new Snapshot<IndexType, KeyType>(filename, term, 1);
+
+    pthread_rwlock_wrlock(&lock);
+    old = current;
+    current = s;
+    pthread_rwlock_unlock(&lock);
+
+    if (old)
+	Release(old);
+}
+
+/*
+ * Take a reference to the current snapshot, which stays mapped until it
+ * is passed to Release(). It returns NULL if nothing is published.
+ */
+template <class IndexType, class KeyType>
+const Snapshot<IndexType, KeyType> *SnapshotHolder<IndexType, KeyType>::Acquire()
+{
+    Snapshot<IndexType, KeyType> *s;
+
+    pthread_rwlock_rdlock(&lock);
+    s = current;
+    if (s)
+	__sync_add_and_fetch(&s->refs, 1);
+    pthread_rwlock_unlock(&lock);
+
+    return s;
+}
+
+template <class IndexType, class KeyType>
+void SnapshotHolder<IndexType, KeyType>::Release(const Snapshot<IndexType, KeyType> *s)
+{
+    if (__sync_sub_and_fetch(&s->refs, 1) == 0)
+	delete s;
+}
+
+/*
+ * Search the specified key in the current snapshot. It returns 0 if
+ * nothing is published.
+ */
+template <class IndexType, class KeyType>
+IndexType SnapshotHolder<IndexType, KeyType>::Search(const KeyType *a)
+{
+    const Snapshot<IndexType, KeyType> *s = Acquire();
+    IndexType index = 0;
+
+    if (s) {
+	index = s->Search(a);
+	Release(s);
+    }
+
+    return index;
+}
+
+}
+
+#endif // _MADA_SNAPSHOT_HPP_
@@ -22,9 +22,37 @@
 #include <stdio.h>
 #include <time.h>
 #include <limits.h>
+#include <sys/time.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <fnmatch.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 #include "MappedArray.hpp"
 #include "DoubleArray.hpp"
+#include "CompactDoubleArray.hpp"
+#include "AhoCorasick.hpp"
+#include "Cursor.hpp"
+#include "Snapshot.hpp"
+#include "Attributes.hpp"
+#include "KeyFilter.hpp"
+#include "LoudsTrie.hpp"
+#include "Container.hpp"
+
+#ifdef MADA_INDEX64
+typedef long long IndexType; // for double arrays beyond 2^31 cells
+#else
+typedef int IndexType;
+#endif
 
 void s2us(unsigned char *dest, const char *src)
 {
@@ -33,6 +61,159 @@ void s2us(unsigned char *dest, const char *src)
 	dest[i] = static_cast<unsigned char>(src[i]);
 }
 
+/*
+ * Hardware counters of this thread for benchmarks. A counter which
+ * cannot be opened (no permission, or no PMU in a virtual machine) is
+ * reported as "n/a".
+ */
+struct PerfCounters
+{
+    enum { L1D_MISS, LLC_MISS, DTLB_MISS, NUM_COUNTER };
+    int fd[NUM_COUNTER];
+
+    PerfCounters()
+    {
+#ifdef __linux__
+	unsigned long long config[NUM_COUNTER] = {
+	    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+	    PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+	    PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+	};
+
+	for (int i = 0; i < NUM_COUNTER; i++) {
+	    struct perf_event_attr attr;
+
+	    memset (&attr, 0, sizeof(attr));
+	    attr.size = sizeof(attr);
+	    attr.type = PERF_TYPE_HW_CACHE;
+	    attr.config = config[i];
+	    attr.disabled = 1;
+	    attr.exclude_kernel = 1;
+	    attr.exclude_hv = 1;
+	    fd[i] = syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#else
+	for (int i = 0; i < NUM_COUNTER; i++)
+	    fd[i] = -1;
+#endif
+    }
+
+    ~PerfCounters()
+    {
+	for (int i = 0; i < NUM_COUNTER; i++)
+	    if (fd[i] >= 0)
+		close (fd[i]);
+    }
+
+    void Start()
+    {
+#ifdef __linux__
+	for (int i = 0; i < NUM_COUNTER; i++) {
+	    if (fd[i] >= 0) {
+		ioctl (fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl (fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	    }
+	}
+#endif
+    }
+
+    void Stop()
+    {
+#ifdef __linux__
+	for (int i = 0; i < NUM_COUNTER; i++)
+	    if (fd[i] >= 0)
+		ioctl (fd[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    }
+
+    // print counts per operation
+    void Print(size_t ops)
+    {
+	const char *name[NUM_COUNTER] = {
+	    "L1D read misses", "LLC read misses", "dTLB read misses"
+	};
+
+	for (int i = 0; i < NUM_COUNTER; i++) {
+	    long long count;
+
+	    if (fd[i] >= 0 && ops > 0 &&
+		read (fd[i], &count, sizeof(count)) == sizeof(count))
+		printf ("%s: %.2f per lookup\n", name[i], (double) count / ops);
+	    else
+		printf ("%s: n/a\n", name[i]);
+	}
+    }
+};
+
+// attributes of a key for "set_attr" and "attr"
+struct Entry
+{
+    int value;
+};
+
+struct MatchCounter
+{
+    size_t bytes; // the total length of matched keys
+
+    MatchCounter() : bytes(0) {}
+    void operator()(size_t, size_t len, IndexType) { bytes += len; }
+};
+
+struct FuzzyPrinter
+{
+    void operator()(const unsigned char *key, size_t len, int dist,
+		    IndexType)
+    {
+	printf ("FOUND \"%.*s\" (distance %d).\n", (int) len, key, dist);
+    }
+};
+
+struct FuzzyCounter
+{
+    void operator()(const unsigned char *, size_t, int, IndexType) {}
+};
+
+// conflict policy of "merge" for the attributes of words
+struct MergeValues
+{
+    enum { KEEP, REPLACE, SUM };
+
+    mada::Attributes<IndexType, unsigned char, Entry> *attr; // or NULL
+    const std::vector<int> *values; // values of the other words by id
+    int policy;
+    size_t conflicts;
+
+    void operator()(IndexType id, IndexType other_id, int conflict)
+    {
+	int value = (*values)[other_id];
+
+	conflicts += conflict;
+	if (!attr)
+	    return;
+
+	if (!conflict || policy == REPLACE)
+	    (*attr)[id].value = value;
+	else if (policy == SUM)
+	    (*attr)[id].value += value;
+    }
+};
+
+struct PatternPrinter
+{
+    void operator()(const unsigned char *key, size_t len, IndexType)
+    {
+	printf ("FOUND \"%.*s\".\n", (int) len, key);
+    }
+};
+
+struct PatternCounter
+{
+    void operator()(const unsigned char *, size_t, IndexType) {}
+};
+
 void printConsoleHelp()
 {
     printf ("===== COMMAND LIST =====\n\n");
@@ -41,23 +222,480 @@ void printConsoleHelp()
     printf (" add words: Add a word to this double array.\n");
     printf (" remove words: Delete a word from this double array.\n");
     printf (" search words: Search a word in this double array.\n");
+    printf (" attr words: Show the attribute of a word.\n");
+    printf (" set_attr n words: Set the attribute of a word to n.\n");
+    printf (" fuzzy k words: Search words within edit distance k.\n");
+    printf (" pattern n pattern: List up to n words matching ?, * and [...].\n");
     printf (" load file: Add words in file.\n");
+    printf (" batch n file: Add words in file by batches of n words.\n");
     printf (" search_file file: Search all words in file.\n");
+    printf (" fuzzy_file k file: Fuzzy search all words in file.\n");
+    printf (" bench_pattern file: Search patterns in file, and scan all words.\n");
+    printf (" build file: Rebuild from words in file with all processors.\n");
+    printf (" scan file: Find all occurrences of words in file.\n");
+    printf (" segment file: Split file into longest-match words.\n");
+    printf (" snapshot file: Write a snapshot of this double array.\n");
+    printf (" publish file: Switch lookups to a snapshot.\n");
+    printf (" bench_pack n file: Open n copies as snapshot files and as a container.\n");
+    printf (" lookup words: Search a word in the published snapshot.\n");
+    printf (" compact file: Export to a compact array (4 bytes per cell).\n");
+    printf (" louds file: Export to a LOUDS trie (about 12 bits per node).\n");
+    printf (" unlouds file: Rebuild from a LOUDS trie.\n");
+    printf (" bench_louds n file words: Search words n times in both tries.\n");
+    printf (" range lo hi: List words in [lo, hi).\n");
+    printf (" export file: Write all words to file in order.\n");
+    printf (" bench_xcheck n: Time the base search on all nodes n times.\n");
+    printf (" bench_add n file: Add words in file to a new array n times.\n");
+    printf (" relayout: Place nodes near their parents.\n");
+    printf (" merge keep|replace|sum file: Merge words (\"value\\tword\") in file.\n");
+    printf (" relayout_profile file: Place nodes by lookups in a query log.\n");
+    printf (" bench_search n file: Search words in file or query log n times.\n");
+    printf (" bench_batch n file: Search words in file n times, many at once.\n");
+    printf (" bench_key n file: Restore words in file from ids n times.\n");
+    printf (" bench_threads n file: Search words in file with 1 to n threads.\n");
+    printf (" filter n: Build the key filter with n bits per word.\n");
+    printf (" bench_filter n file: Search n words at hit ratios with the filter.\n");
     printf (" dump: Dump double array.\n");
-    printf (" info: Show the information of current double array.\n\n");
+    printf (" info: Show the information of current double array.\n");
+    printf (" verify: Check the structure of this double array.\n");
+    printf (" fuzz n seed: Check n random updates of a scratch double array.\n");
+    printf (" check_compact n seed: Check compact arrays of n random words.\n");
+    printf (" memory: Show the pages in memory and the nodes at each depth.\n");
+    printf (" warm n: Read the pages of nodes up to depth n (all if n < 0).\n\n");
+}
+
+// a reader thread of "bench_threads"
+struct LookupJob
+{
+    const mada::DoubleArray<IndexType, unsigned char> *da;
+    const std::vector<const unsigned char *> *words;
+    size_t offset; // each thread starts at a different word
+    size_t found;
+};
+
+void *lookupWorker(void *arg)
+{
+    LookupJob *job = static_cast<LookupJob *>(arg);
+    const std::vector<const unsigned char *> &words = *job->words;
+
+    job->found = 0;
+    for (size_t i = 0; i < words.size(); i++)
+	job->found += job->da->Search (words[(i + job->offset) % words.size()]) != 0;
+
+    return NULL;
+}
+
+// "fuzz": random updates of a scratch double array, checked against
+// std::map and by Verify()
+double elapsedNs(const struct timespec &start, const struct timespec &end)
+{
+    return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+std::string randomKey(char term)
+{
+    std::string key;
+    int len = rand() % 9;
+
+    // Mostly 4 letters, so that keys share prefixes and nodes collide.
+    for (int i = 0; i < len; i++) {
+	int c = rand() % 5 ? 'a' + rand() % 4 : 1 + rand() % UCHAR_MAX;
+	key += (char) (c == term ? c + 1 : c);
+    }
+
+    return key + term;
+}
+
+size_t runFuzz(int n, unsigned int seed)
+{
+    const char term = '\n';
+    static const char *names[] = { "add", "remove", "search" };
+    std::map<std::string, IndexType> expected; // key -> id
+    std::vector<std::string> pool; // keys added so far
+    double ns[3] = { 0, 0, 0 };
+    size_t ops[3] = { 0, 0, 0 }, failures = 0, verified = 0;
+    int every = n / 20 > 100 ? n / 20 : 100;
+
+    srand (seed);
+    {
+	mada::DoubleArray<IndexType, unsigned char> da("fuzz_base",
+						       "fuzz_check",
+						       term, UCHAR_MAX, 1);
+
+	for (int i = 0; i < n && failures < 10; i++) {
+	    std::string k = !pool.empty() && rand() % 2 ?
+		pool[rand() % pool.size()] : randomKey(term);
+	    const unsigned char *key = (const unsigned char *) k.c_str();
+	    int r = rand() % 10, op = r < 5 ? 0 : r < 8 ? 1 : 2;
+	    std::map<std::string, IndexType>::iterator it = expected.find(k);
+	    int found = it != expected.end();
+	    struct timespec start, end;
+	    IndexType ret, id = -1;
+
+	    clock_gettime (CLOCK_MONOTONIC, &start);
+	    if (op == 0)
+		ret = da.Add (key, &id);
+	    else if (op == 1)
+		ret = da.Remove (key);
+	    else
+		ret = da.Search (key);
+	    clock_gettime (CLOCK_MONOTONIC, &end);
+
+	    ns[op] += elapsedNs(start, end);
+	    ops[op]++;
+
+	    int ok;
+	    if (op == 0) {
+		ok = ret == !found && (!found || id == it->second);
+		if (!found) {
+		    expected[k] = id;
+		    pool.push_back(k);
+		}
+	    } else if (op == 1) {
+		ok = ret == found;
+		if (found)
+		    expected.erase(it);
+	    } else
+		ok = (ret != 0) == found && (!found || da.Id (ret) == it->second);
+
+	    if (!ok) {
+		printf ("Mismatch at operation %d: %s \"%.*s\" returned %lld\n",
+			i, names[op], (int) k.size() - 1, k.c_str(),
+			(long long) ret);
+		failures++;
+	    }
+
+	    if ((i + 1) % every == 0 || i == n - 1) {
+		size_t problems = da.Verify (1);
+
+		if (problems || da.NumKey () != (IndexType) expected.size()) {
+		    printf ("After operation %d: %lu problems, %lld keys "
+			    "(expected %lu)\n", i, (unsigned long) problems,
+			    (long long) da.NumKey (),
+			    (unsigned long) expected.size());
+		    failures++;
+		}
+		verified++;
+	    }
+	}
+
+	// All keys left must be found with their ids.
+	for (std::map<std::string, IndexType>::iterator it = expected.begin();
+	     it != expected.end(); it++) {
+	    if (da.SearchId ((const unsigned char *) it->first.c_str()) !=
+		it->second) {
+		printf ("Lost \"%.*s\"\n", (int) it->first.size() - 1,
+			it->first.c_str());
+		failures++;
+	    }
+	}
+    }
+    unlink ("fuzz_base");
+    unlink ("fuzz_check");
+
+    printf ("%d operations (seed %u), %lu keys left, %lu checks of the "
+	    "structure\n", n, seed, (unsigned long) expected.size(),
+	    (unsigned long) verified);
+    printf ("op\tcount\tns/op\n");
+    for (int op = 0; op < 3; op++)
+	printf ("%s\t%lu\t%.1f\n", names[op], (unsigned long) ops[op],
+		ops[op] ? ns[op] / ops[op] : 0.0);
+    printf ("%s (%lu failures)\n", failures ? "FAILED" : "OK",
+	    (unsigned long) failures);
+
+    return failures;
+}
+
+// "check_compact": CompactDoubleArray checked against the double arrays it
+// is built from, and its limits
+int expectThrow(const char *what, int thrown, int expected)
+{
+    printf ("%s: %s (exception %d, expected %d)\n", what,
+	    thrown == expected ? "OK" : "FAILED", thrown, expected);
+
+    return thrown != expected;
+}
+
+size_t runCompactCheck(int n, unsigned int seed)
+{
+    const unsigned char term = '\n';
+    size_t failures = 0;
+
+    srand (seed);
+
+    // Every key and as many probes are searched in both arrays, after a
+    // quarter of the keys are removed.
+    {
+	mada::DoubleArray<IndexType, unsigned char> da("compact_base",
+						       "compact_check",
+						       term, UCHAR_MAX, 1);
+	mada::CompactDoubleArray<unsigned char> cda("compact_unit", term);
+	std::vector<std::string> keys;
+	size_t mismatches = 0;
+
+	for (int i = 0; i < n; i++) {
+	    keys.push_back(randomKey(term));
+	    da.Add ((const unsigned char *) keys.back().c_str());
+	}
+	for (int i = 0; i < n / 4; i++)
+	    da.Remove ((const unsigned char *) keys[rand() % n].c_str());
+	for (int i = 0; i < n; i++)
+	    keys.push_back(randomKey(term));
+
+	if (cda.Build (da) != (uint32_t) da.NumKey ())
+	    mismatches++;
+	for (size_t i = 0; i < keys.size(); i++) {
+	    const unsigned char *key = (const unsigned char *) keys[i].c_str();
+
+	    if ((cda.Search (key) != 0) != (da.Search (key) != 0)) {
+		printf ("Mismatch: \"%.*s\"\n", (int) keys[i].size() - 1,
+			keys[i].c_str());
+		mismatches++;
+	    }
+	}
+
+	printf ("round trip: %s (%lld keys, %lu searches, %lu mismatches)\n",
+		mismatches ? "FAILED" : "OK", (long long) da.NumKey (),
+		(unsigned long) keys.size(), (unsigned long) mismatches);
+	failures += mismatches;
+    }
+
+    // A label needs 8 bits, and the terminal symbol must be the same.
+    {
+	mada::DoubleArray<IndexType, unsigned short> wide("compact_base",
+							  "compact_check",
+							  term, 300, 1);
+	mada::CompactDoubleArray<unsigned short> cda("compact_unit", term);
+	int e = 0;
+
+	try {
+	    cda.Build (wide);
+	} catch (int ex) {
+	    e = ex;
+	}
+	failures += expectThrow("labels over 8 bits", e, 1);
+    }
+    {
+	mada::DoubleArray<IndexType, unsigned char> da("compact_base",
+						       "compact_check",
+						       '\t', UCHAR_MAX, 1);
+	mada::CompactDoubleArray<unsigned char> cda("compact_unit", term);
+	int e = 0;
+
+	try {
+	    cda.Build (da);
+	} catch (int ex) {
+	    e = ex;
+	}
+	failures += expectThrow("another terminal symbol", e, 1);
+    }
+
+    // 4096 keys of 4100 labels which share at most one label have more than
+    // 2^24 nodes, so some BASE does not fit in 24 bits.
+    {
+	const size_t count = 4096, len = 4100;
+	std::vector<unsigned char> buf(count * len, 'x');
+	std::vector<const unsigned char *> keys;
+
+	for (size_t i = 0; i < count; i++) {
+	    unsigned char *key = &buf[i * len];
+
+	    key[0] = 'A' + i / 64;
+	    key[1] = 'A' + i % 64;
+	    key[len - 1] = term;
+	    keys.push_back(key);
+	}
+
+	mada::DoubleArray<IndexType, unsigned char> da("compact_base",
+						       "compact_check",
+						       term, UCHAR_MAX, 1);
+	mada::CompactDoubleArray<unsigned char> cda("compact_unit", term);
+	int e = 0;
+
+	da.Build (keys, 0);
+	try {
+	    cda.Build (da);
+	} catch (int ex) {
+	    e = ex;
+	}
+	failures += expectThrow("more than 2^24 cells", e, 2);
+    }
+
+#ifdef MADA_INDEX64
+    // The leaf of "a" is moved to a cell above 2^31 by rewriting sparse
+    // files, since Add() fills every cell up to a new one.
+    {
+	const IndexType far = ((IndexType) 1 << 31) + 7;
+	const unsigned char a[] = { 'a', term, 0 }, b[] = { 'b', term, 0 };
+	const unsigned char c[] = { 'c', term, 0 };
+	{
+	    mada::DoubleArray<IndexType, unsigned char> da("compact_base",
+							   "compact_check",
+							   term, UCHAR_MAX, 1);
+	    da.Add (a);
+	    da.Add (b);
+	}
+
+	int fb = open ("compact_base", O_RDWR);
+	int fc = open ("compact_check", O_RDWR);
+	mada::FileHeader h;
+	IndexType node, leaf, id, zero = 0, moved, parent;
+	size_t cell = sizeof(IndexType);
+	int ok = fb != -1 && fc != -1 &&
+	    pread (fb, &h, sizeof(h), 0) == sizeof(h) &&
+	    pread (fb, &node, cell, sizeof(h) + cell) == (ssize_t) cell;
+
+	node += 'a';
+	ok = ok && pread (fb, &leaf, cell, sizeof(h) + node * cell) ==
+	    (ssize_t) cell;
+	leaf += term;
+	ok = ok && pread (fb, &id, cell, sizeof(h) + leaf * cell) ==
+	    (ssize_t) cell;
+
+	h.da_size = far;
+	h.e_head = 0;
+	h.flags &= ~MADA_FLAG_CLEAN;
+	h.checksum = 0;
+	moved = far - term;
+	parent = node;
+	ok = ok &&
+	    ftruncate (fb, sizeof(h) + (far + 1) * cell) == 0 &&
+	    ftruncate (fc, sizeof(h) + (far + 1) * cell) == 0 &&
+	    pwrite (fb, &h, sizeof(h), 0) == sizeof(h) &&
+	    pwrite (fc, &h, sizeof(h), 0) == sizeof(h) &&
+	    pwrite (fb, &moved, cell, sizeof(h) + node * cell) ==
+	    (ssize_t) cell &&
+	    pwrite (fb, &id, cell, sizeof(h) + far * cell) == (ssize_t) cell &&
+	    pwrite (fc, &parent, cell, sizeof(h) + far * cell) ==
+	    (ssize_t) cell &&
+	    pwrite (fb, &zero, cell, sizeof(h) + leaf * cell) ==
+	    (ssize_t) cell &&
+	    pwrite (fc, &zero, cell, sizeof(h) + leaf * cell) == (ssize_t) cell;
+	if (fb != -1)
+	    close (fb);
+	if (fc != -1)
+	    close (fc);
+
+	if (ok) {
+	    mada::DoubleArray<IndexType, unsigned char> da("compact_base",
+							   "compact_check",
+							   term, UCHAR_MAX, 0);
+	    mada::CompactDoubleArray<unsigned char> cda("compact_unit", term);
+
+	    ok = da.Search (a) == far && da.Search (b) != 0 &&
+		cda.Build (da) == 2 && cda.Search (a) && cda.Search (b) &&
+		!cda.Search (c);
+	}
+
+	printf ("index above 2^31: %s\n", ok ? "OK" : "FAILED");
+	failures += !ok;
+    }
+#else
+    printf ("index above 2^31: skipped (build with -DMADA_INDEX64)\n");
+#endif
+
+    unlink ("compact_base");
+    unlink ("compact_check");
+    unlink ("compact_unit");
+
+    printf ("%s (%lu failures)\n", failures ? "FAILED" : "OK",
+	    (unsigned long) failures);
+
+    return failures;
+}
+
+// "bench_xcheck": X_Check() on the label sets of the nodes which have two
+// or more children (a node with one child fits at the first unused cell).
+// Both the search along the unused element list and the linear search are
+// timed, the latter on the first 1000 sets only. The sums of the bases
+// tell whether builds with and without MADA_NO_SIMD choose the same ones.
+void benchXCheck(mada::DoubleArray<IndexType, unsigned char> &da, int repeat)
+{
+    std::vector<unsigned char> labels;
+    std::vector<size_t> offsets;
+
+    da.LabelSets(labels, offsets, 2);
+
+    size_t nsets = offsets.size() - 1;
+    if (nsets == 0 || repeat < 1)
+	return;
+
+    printf ("X_Check: %lu label sets (%.2f labels/set), %d rounds\n",
+	    (unsigned long) nsets, (double) labels.size() / nsets, repeat);
+
+    for (int linear = 0; linear < 2; linear++) {
+	size_t count = linear && nsets > 1000 ? 1000 : nsets;
+	long long sum = 0;
+	struct timespec start, end;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (int r = 0; r < repeat; r++)
+	    for (size_t i = 0; i < count; i++)
+		sum += da.FindBase (&labels[offsets[i]],
+				    offsets[i+1] - offsets[i], linear);
+	clock_gettime (CLOCK_MONOTONIC, &end);
+
+	printf ("%s: %.1f ns/call, sum of bases %lld\n",
+		linear ? "linear search" : "unused list",
+		elapsedNs(start, end) / ((double) count * repeat), sum);
+    }
+}
+
+// "bench_add": Add() words to a scratch double array, which searches a
+// base by X_Check() for every node that gets a new child
+void benchAdd(int repeat, const char *file, unsigned char term)
+{
+    mada::MappedWordList<unsigned char> list(file, term);
+    std::vector<const unsigned char *> words;
+    const unsigned char *word;
+    size_t len, added = 0;
+    double ns = 0;
+
+    while ((word = list.Next(&len)))
+	words.push_back(word);
+
+    for (int r = 0; r < repeat; r++) {
+	{
+	    mada::DoubleArray<IndexType, unsigned char> da("xcheck_base",
+							   "xcheck_check",
+							   term, UCHAR_MAX, 1);
+	    struct timespec start, end;
+
+	    clock_gettime (CLOCK_MONOTONIC, &start);
+	    for (size_t i = 0; i < words.size(); i++)
+		added += da.Add (words[i]) != 0;
+	    clock_gettime (CLOCK_MONOTONIC, &end);
+
+	    ns += elapsedNs(start, end);
+	}
+	unlink ("xcheck_base");
+	unlink ("xcheck_check");
+    }
+
+    size_t adds = words.size() * (repeat > 0 ? repeat : 0);
+    printf ("%lu adds, %lu new words\n", (unsigned long) adds,
+	    (unsigned long) added);
+    if (adds > 0)
+	printf ("%.1f ns/add\n", ns / adds);
 }
 
 void launchConsole(int init)
 {
     char command[256];
     char key[256];
+    char upper[256]; // the second word of "range"
     unsigned char ukey[256];
     char term = '\n';
+    int k;
+    unsigned int seed;
 
     // initialize double array
-    mada::DoubleArray<int, unsigned char> da("base",
+    mada::DoubleArray<IndexType, unsigned char> da("base",
 					     "check",
 					     term, UCHAR_MAX, init);
+    mada::SnapshotHolder<IndexType, unsigned char> holder(term);
+    mada::Attributes<IndexType, unsigned char, Entry> attr(da, "attr");
+    mada::KeyFilter<IndexType, unsigned char> filter(da, "filter");
 
     while (1) {
 	printf("> ");
@@ -75,11 +713,13 @@ void launchConsole(int init)
 	    key[len-1] = term; // replace '\n' with the terminal symbol.
 	    s2us (ukey, key);
 
+	    IndexType id;
 	    clock_t start = clock();
-	    int res = da.Add (ukey);
+	    int res = filter.Add (ukey, &id);
 	    clock_t end = clock();
 
 	    if (res) {
+		attr.Erase (id); // the id may have belonged to a removed word
 		printf("ADDED \"%s\".\n", key);
 		printf ("%f msec\n", (float)(end-start)/(float)CLOCKS_PER_SEC*1000.0);
 	    } else
@@ -92,9 +732,11 @@ void launchConsole(int init)
 	    key[len-1] = term; // replace '\n' with the terminal symbol.
 	    s2us (ukey, key);
 
-	    if (da.Remove (ukey))
+	    IndexType id = da.SearchId (ukey);
+	    if (filter.Remove (ukey)) {
+		attr.Erase (id); // the id is given to the next new word
 		printf("DELETED \"%s\".\n", key);
-	    else
+	    } else
 		printf("Failed to delete \"%s\".\n", key);
 	} else if (strncmp (command, "search ", 7) == 0 &&
 		   command[7] != '\0') {
@@ -104,80 +746,943 @@ void launchConsole(int init)
 	    ukey[len-1] = term; // replace '\n' with the terminal symbol.
 	    s2us (ukey, key);
 
-	    if (da.Search (ukey))
-		printf("FOUND \"%s\".\n", key);
+	    IndexType id = da.SearchId (ukey);
+	    if (id >= 0)
+		printf("FOUND \"%s\" (id %lld).\n", key, (long long) id);
 	    else
 		printf("Failed to find \"%s\".\n", key);
-	} else if (strncmp (command, "load ", 5) == 0 &&
-		   command[5] != '\0') {
-	    strcpy (key, command + 5);
-	    key[strlen(key)-1] = '\0';
+	} else if ((strncmp (command, "attr ", 5) == 0 &&
+		    sscanf (command + 5, "%254[^\n]", key) == 1) ||
+		   (strncmp (command, "set_attr ", 9) == 0 &&
+		    sscanf (command + 9, "%d %254[^\n]", &k, key) == 2)) {
+	    int len = strlen (key);
+	    key[len] = term;
+	    key[len+1] = '\0';
+	    s2us (ukey, key);
+	    key[len] = '\0';
 
-	    FILE *f = fopen (key, "r");
-	    if (!f) {
+	    if (!attr.IsValid ()) {
+		printf ("Attributes are reset for new ids.\n");
+		attr.Reset ();
+	    }
+
+	    Entry *e = attr.Find (ukey);
+	    if (!e)
+		printf("Failed to find \"%s\".\n", key);
+	    else if (command[0] == 's')
+		e->value = k;
+	    else
+		printf("\"%s\": %d\n", key, e->value);
+	} else if (strncmp (command, "fuzzy ", 6) == 0 &&
+		   sscanf (command + 6, "%d %254[^\n]", &k, key) == 2) {
+	    int len = strlen (key);
+	    key[len] = term;
+	    key[len+1] = '\0';
+	    s2us (ukey, key);
+
+	    FuzzyPrinter printer;
+	    if (!da.FuzzySearch (ukey, k, printer)) {
+		key[len] = '\0';
+		printf("Failed to find \"%s\".\n", key);
+	    }
+	} else if (strncmp (command, "fuzzy_file ", 11) == 0 &&
+		   sscanf (command + 11, "%d %255[^\n]", &k, key) == 2) {
+	    try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		const unsigned char *word;
+		size_t len, queries = 0, count = 0;
+		FuzzyCounter counter;
+
+		clock_t start = clock();
+
+		while ((word = list.Next(&len))) {
+		    count += da.FuzzySearch (word, k, counter);
+		    queries++;
+		}
+
+		clock_t end = clock();
+		float sec = (float)(end-start)/(float)CLOCKS_PER_SEC;
+
+		printf ("Found %lu keys for %lu words\n",
+			(unsigned long) count, (unsigned long) queries);
+		printf ("%f sec (%.1f usec/word)\n",
+			sec, sec * 1000000.0 / queries);
+	    } catch (int e) {
 		printf ("Failed to open %s\n", key);
 		return;
 	    }
+	} else if (strncmp (command, "pattern ", 8) == 0 &&
+		   sscanf (command + 8, "%d %254[^\n]", &k, key) == 2) {
+	    int len = strlen (key);
+	    key[len] = term;
+	    key[len+1] = '\0';
+	    s2us (ukey, key);
 
-	    int count = 0;
-	    clock_t start = clock();
+	    PatternPrinter printer;
+	    if (!da.PatternSearch (ukey, k > 0 ? k : 0, printer)) {
+		key[len] = '\0';
+		printf("Failed to find \"%s\".\n", key);
+	    }
+	} else if (strncmp (command, "bench_pattern ", 14) == 0 &&
+		   command[14] != '\0') {
+	    strcpy (key, command + 14);
+	    key[strlen(key)-1] = '\0';
 
-	    while (fgets (key, 255, f))
-	    {
-		size_t len = strlen (key);
+	    try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		const unsigned char *word;
+		size_t len;
+		double total[2] = { 0, 0 };
 
-		if (len >= 1)
-		{
-		    key[len-1] = term; /* replace '\n' with terminal symbol */
-		    s2us (ukey, key);
-		    count += da.Add (ukey);
+		// Each pattern is searched in the trie, and then by matching
+		// every word from a cursor with fnmatch().
+		printf ("found\ttrie\tscan\t(usec) pattern\n");
+		while ((word = list.Next(&len))) {
+		    char pattern[256];
+		    char buf[256];
+		    PatternCounter counter;
+		    struct timeval start, mid, end;
+		    size_t found, scanned = 0;
+
+		    if (len >= sizeof(pattern))
+			continue;
+		    memcpy (pattern, word, len);
+		    pattern[len] = '\0';
+
+		    gettimeofday (&start, NULL);
+		    found = da.PatternSearch (word, 0, counter);
+		    gettimeofday (&mid, NULL);
+
+		    mada::Cursor<IndexType, unsigned char> c(da);
+		    for (int ok = c.Begin (); ok; ok = c.Next ()) {
+			if (c.Length () >= sizeof(buf))
+			    continue;
+			memcpy (buf, c.Key (), c.Length ());
+			buf[c.Length ()] = '\0';
+			scanned += fnmatch (pattern, buf, 0) == 0;
+		    }
+		    gettimeofday (&end, NULL);
+
+		    double trie = (mid.tv_sec - start.tv_sec) * 1e6 +
+			(mid.tv_usec - start.tv_usec);
+		    double scan = (end.tv_sec - mid.tv_sec) * 1e6 +
+			(end.tv_usec - mid.tv_usec);
+		    total[0] += trie;
+		    total[1] += scan;
+
+		    printf ("%lu\t%.0f\t%.0f\t%s%s\n", (unsigned long) found,
+			    trie, scan, pattern, found == scanned ? "" : " MISMATCH");
 		}
+
+		printf ("total\t%.0f\t%.0f\n", total[0], total[1]);
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
 	    }
-	    fclose (f);
+	} else if (strncmp (command, "load ", 5) == 0 &&
+		   command[5] != '\0') {
+	    strcpy (key, command + 5);
+	    key[strlen(key)-1] = '\0';
 
+	    clock_t start = clock();
+	    int count = da.loadWordList (key);
 	    clock_t end = clock();
 
+	    if (count < 0) {
+		printf ("Failed to open %s\n", key);
+		return;
+	    }
+
 	    printf ("Added %d keys\n", count);
 	    printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+	} else if (strncmp (command, "batch ", 6) == 0 &&
+		   sscanf (command + 6, "%d %255[^\n]", &k, key) == 2 &&
+		   k > 0) {
+	    try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		vector<const unsigned char *> batch;
+		const unsigned char *word;
+		size_t len;
+		int count = 0;
+
+		clock_t start = clock();
+
+		while ((word = list.Next(&len))) {
+		    batch.push_back (word);
+		    if (batch.size() == (size_t) k) {
+			count += da.AddBatch (batch);
+			batch.clear ();
+		    }
+		}
+		count += da.AddBatch (batch);
+
+		clock_t end = clock();
+
+		printf ("Added %d keys\n", count);
+		printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
+		return;
+	    }
 	} else if (strncmp (command, "search_file ", 12) == 0 &&
 		   command[12] != '\0') {
 	    strcpy (key, command + 12);
 	    key[strlen(key)-1] = '\0';
 
-	    FILE *f = fopen (key, "r");
+	    try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		const unsigned char *word;
+		size_t len;
+
+		clock_t start = clock();
+
+		while ((word = list.Next(&len))) {
+		    if (!da.Search (word))
+			printf("Failed to find \"%.*s\".\n", (int) len, word);
+		}
+
+		clock_t end = clock();
+
+		printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
+		return;
+	    }
+	} else if (strncmp (command, "build ", 6) == 0 &&
+		   command[6] != '\0') {
+	    strcpy (key, command + 6);
+	    key[strlen(key)-1] = '\0';
+
+	    // clock() would sum up the time of all threads.
+	    struct timeval start, end;
+	    gettimeofday (&start, NULL);
+	    int count = da.loadSortedWordList (key, 0);
+	    gettimeofday (&end, NULL);
+
+	    if (count < 0) {
+		printf ("Failed to open %s\n", key);
+		return;
+	    }
+
+	    printf ("Built with %d keys\n", count);
+	    printf ("%f sec\n", (end.tv_sec - start.tv_sec) +
+		    (end.tv_usec - start.tv_usec) / 1000000.0);
+	} else if (strncmp (command, "scan ", 5) == 0 &&
+		   command[5] != '\0') {
+	    strcpy (key, command + 5);
+	    key[strlen(key)-1] = '\0';
+
+	    mada::AhoCorasick<IndexType, unsigned char> ac(da, "link");
+
+	    if (!ac.IsValid()) {
+		clock_t start = clock();
+		ac.Build();
+		clock_t end = clock();
+
+		printf ("Built links in %f sec\n",
+			(float)(end-start)/(float)CLOCKS_PER_SEC);
+	    }
+
+	    struct stat st;
+	    int fd = open (key, O_RDONLY);
+	    if (fd == -1 || fstat (fd, &st) != 0) {
+		printf ("Failed to open %s\n", key);
+		return;
+	    }
+
+	    void *text = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	    close (fd);
+	    if (st.st_size == 0 || text == MAP_FAILED) {
+		printf ("Failed to map %s\n", key);
+		return;
+	    }
+
+	    MatchCounter counter;
+	    clock_t start = clock();
+	    size_t count = ac.Match ((const unsigned char *) text, st.st_size,
+				     counter);
+	    clock_t end = clock();
+	    munmap (text, st.st_size);
+
+	    float sec = (float)(end-start)/(float)CLOCKS_PER_SEC;
+	    printf ("Found %lu occurrences (%lu bytes)\n",
+		    (unsigned long) count, (unsigned long) counter.bytes);
+	    printf ("%f sec (%.1f MB/s)\n", sec, st.st_size / 1048576.0 / sec);
+	} else if (strncmp (command, "segment ", 8) == 0 &&
+		   command[8] != '\0') {
+	    strcpy (key, command + 8);
+	    key[strlen(key)-1] = '\0';
+
+	    struct stat st;
+	    int fd = open (key, O_RDONLY);
+	    if (fd == -1 || fstat (fd, &st) != 0) {
+		printf ("Failed to open %s\n", key);
+		return;
+	    }
+
+	    void *text = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	    close (fd);
+	    if (st.st_size == 0 || text == MAP_FAILED) {
+		printf ("Failed to map %s\n", key);
+		return;
+	    }
+
+	    MatchCounter counter;
+	    clock_t start = clock();
+	    size_t count = da.Segment ((const unsigned char *) text, st.st_size,
+				       counter);
+	    clock_t end = clock();
+	    munmap (text, st.st_size);
+
+	    float sec = (float)(end-start)/(float)CLOCKS_PER_SEC;
+	    printf ("Split into %lu tokens (%lu of %lu bytes)\n",
+		    (unsigned long) count, (unsigned long) counter.bytes,
+		    (unsigned long) st.st_size);
+	    printf ("%f sec (%.1f MB/s)\n", sec, st.st_size / 1048576.0 / sec);
+	} else if (strncmp (command, "snapshot ", 9) == 0 &&
+		   command[9] != '\0') {
+	    strcpy (key, command + 9);
+	    key[strlen(key)-1] = '\0';
+
+	    if (da.WriteSnapshot (key) == 0)
+		printf ("Wrote %s\n", key);
+	    else
+		printf ("Failed to write %s\n", key);
+	} else if (strncmp (command, "bench_pack ", 11) == 0 &&
+		   sscanf (command + 11, "%d %255[^\n]", &k, key) == 2 &&
+		   k > 0) {
+	    // the same dictionary under k names, as k snapshot files and as
+	    // one container
+	    std::vector<char> name(strlen (key) + 32);
+	    std::vector<IndexType> leaves;
+	    int failed = 0;
+
+	    // Each dictionary is searched for the word of the first id.
+	    std::vector<unsigned char> word(256);
+	    int len = -1;
+	    da.GetLeaves (leaves);
+	    for (size_t i = 0; len < 0 && i < leaves.size (); i++)
+		len = da.Key (leaves[i], &word[0], word.size ());
+	    if (len < 0 || len >= (int) word.size ()) {
+		printf ("No word to look up\n");
+		continue;
+	    }
+
+	    try {
+		mada::ContainerWriter writer(key);
+
+		for (int i = 0; i < k && !failed; i++) {
+		    sprintf (&name[0], "%s.%d", key, i);
+		    failed = da.WriteSnapshot (&name[0]) != 0 ||
+			writer.Add (&name[0] + strlen (key) + 1, da) != 0;
+		}
+		if (failed || writer.Commit () != 0) {
+		    printf ("Failed to write %s\n", key);
+		    continue;
+		}
+	    } catch (int e) {
+		printf ("Failed to create %s\n", key);
+		continue;
+	    }
+
+	    struct timeval start, mid, end;
+	    size_t found = 0, found_pack = 0;
+
+	    gettimeofday (&start, NULL);
+	    for (int i = 0; i < k; i++) {
+		sprintf (&name[0], "%s.%d", key, i);
+		mada::Snapshot<IndexType, unsigned char> s(&name[0], term, 0);
+		found += s.Search (&word[0]) != 0;
+	    }
+	    gettimeofday (&mid, NULL);
+	    try {
+		mada::Container pack(key);
+
+		for (int i = 0; i < k; i++) {
+		    size_t size;
+		    sprintf (&name[0], "%d", i);
+		    const void *data = pack.Find (&name[0], &size);
+		    if (!data)
+			continue;
+
+		    mada::Snapshot<IndexType, unsigned char> s(data, size,
+							       term, 0);
+		    found_pack += s.Search (&word[0]) != 0;
+		}
+	    } catch (int e) {
+		printf ("Failed to open %s (%d)\n", key, e);
+	    }
+	    gettimeofday (&end, NULL);
+
+	    for (int i = 0; i < k; i++) {
+		sprintf (&name[0], "%s.%d", key, i);
+		unlink (&name[0]);
+	    }
+
+	    printf ("%d files: %.3f ms, found %lu\n", k,
+		    (mid.tv_sec - start.tv_sec) * 1e3 +
+		    (mid.tv_usec - start.tv_usec) / 1e3, (unsigned long) found);
+	    printf ("container: %.3f ms, found %lu\n",
+		    (end.tv_sec - mid.tv_sec) * 1e3 +
+		    (end.tv_usec - mid.tv_usec) / 1e3,
+		    (unsigned long) found_pack);
+	} else if (strncmp (command, "publish ", 8) == 0 &&
+		   command[8] != '\0') {
+	    strcpy (key, command + 8);
+	    key[strlen(key)-1] = '\0';
+
+	    try {
+		clock_t start = clock();
+		holder.Publish (key);
+		clock_t end = clock();
+
+		const mada::Snapshot<IndexType, unsigned char> *s =
+		    holder.Acquire ();
+		printf ("Published %lld keys\n", (long long) s->NumKey ());
+		printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+		holder.Release (s);
+	    } catch (int e) {
+		printf ("Failed to publish %s (%d)\n", key, e);
+	    }
+	} else if (strncmp (command, "lookup ", 7) == 0 &&
+		   command[7] != '\0') {
+	    strcpy (key, command + 7);
+
+	    int len = strlen (key);
+	    key[len-1] = term; // replace '\n' with the terminal symbol.
+	    s2us (ukey, key);
+
+	    if (holder.Search (ukey))
+		printf("FOUND \"%s\".\n", key);
+	    else
+		printf("Failed to find \"%s\".\n", key);
+	} else if (strncmp (command, "compact ", 8) == 0 &&
+		   command[8] != '\0') {
+	    strcpy (key, command + 8);
+	    key[strlen(key)-1] = '\0';
+
+	    try {
+		mada::CompactDoubleArray<unsigned char> cda(key, term);
+
+		clock_t start = clock();
+		unsigned int count = cda.Build (da);
+		clock_t end = clock();
+
+		printf ("Exported %u keys\n", count);
+		printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+		cda.printInfo();
+	    } catch (int e) {
+		printf ("Failed to export to %s (%d)\n", key, e);
+	    }
+	} else if ((strncmp (command, "louds ", 6) == 0 &&
+		    sscanf (command + 6, "%255[^\n]", key) == 1) ||
+		   (strncmp (command, "unlouds ", 8) == 0 &&
+		    sscanf (command + 8, "%255[^\n]", key) == 1)) {
+	    try {
+		mada::LoudsTrie<unsigned char> louds(key, term);
+		clock_t start = clock();
+		long long count;
+
+		if (command[0] == 'l')
+		    count = louds.Build (da);
+		else
+		    count = louds.Restore (da, 0);
+		clock_t end = clock();
+
+		printf ("%s %lld keys\n", command[0] == 'l' ? "Exported" :
+			"Restored", count);
+		printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+		louds.printInfo();
+	    } catch (int e) {
+		printf ("Failed to open %s (%d)\n", key, e);
+	    }
+	} else if (strncmp (command, "bench_louds ", 12) == 0 &&
+		   sscanf (command + 12, "%d %255s %255[^\n]", &k, key,
+			   (char *) ukey) == 3) {
+	    try {
+		mada::LoudsTrie<unsigned char> louds(key, term);
+		mada::MappedWordList<unsigned char> list((const char *) ukey,
+							 term);
+		std::vector<const unsigned char *> words;
+		const unsigned char *word;
+		size_t len, found[2] = { 0, 0 };
+		struct timeval start, mid, end;
+
+		while ((word = list.Next(&len)))
+		    words.push_back(word);
+
+		srand (1);
+		std::random_shuffle (words.begin(), words.end());
+
+		gettimeofday (&start, NULL);
+		for (int r = 0; r < k; r++)
+		    for (size_t i = 0; i < words.size(); i++)
+			found[0] += da.Search (words[i]) != 0;
+		gettimeofday (&mid, NULL);
+		for (int r = 0; r < k; r++)
+		    for (size_t i = 0; i < words.size(); i++)
+			found[1] += louds.Search (words[i]) >= 0;
+		gettimeofday (&end, NULL);
+
+		double lookups = (double) words.size() * (k > 0 ? k : 0);
+		double sec[2] = {
+		    (mid.tv_sec - start.tv_sec) +
+		    (mid.tv_usec - start.tv_usec) / 1000000.0,
+		    (end.tv_sec - mid.tv_sec) +
+		    (end.tv_usec - mid.tv_usec) / 1000000.0
+		};
+		printf ("double array: %lu found, %.1f ns/lookup\n",
+			(unsigned long) found[0], sec[0] * 1e9 / lookups);
+		da.printInfo();
+		printf ("LOUDS trie: %lu found, %.1f ns/lookup\n",
+			(unsigned long) found[1], sec[1] * 1e9 / lookups);
+		louds.printInfo();
+	    } catch (int e) {
+		printf ("Failed to open %s or %s\n", key, (char *) ukey);
+	    }
+	} else if (strncmp (command, "range ", 6) == 0 &&
+		   sscanf (command + 6, "%254s %254s", key, upper) == 2) {
+	    unsigned char lo[256], hi[256];
+	    int len;
+
+	    len = strlen (key);
+	    key[len] = term;
+	    key[len+1] = '\0';
+	    s2us (lo, key);
+
+	    len = strlen (upper);
+	    upper[len] = term;
+	    upper[len+1] = '\0';
+	    s2us (hi, upper);
+
+	    mada::Cursor<IndexType, unsigned char> c(da);
+	    for (int ok = c.Range (lo, hi); ok; ok = c.Next ())
+		printf ("%.*s\n", (int) c.Length (), c.Key ());
+	} else if (strncmp (command, "export ", 7) == 0 &&
+		   command[7] != '\0') {
+	    strcpy (key, command + 7);
+	    key[strlen(key)-1] = '\0';
+
+	    FILE *f = fopen (key, "w");
 	    if (!f) {
 		printf ("Failed to open %s\n", key);
 		return;
 	    }
 
+	    int count = 0;
 	    clock_t start = clock();
 
-	    while (fgets (key, 255, f)) {
-		size_t len = strlen (key);
-		
-		if (len >= 1)
+	    mada::Cursor<IndexType, unsigned char> c(da);
+	    for (int ok = c.Begin (); ok; ok = c.Next ()) {
+		fwrite (c.Key (), 1, c.Length (), f);
+		fputc ('\n', f);
+		count++;
+	    }
+
+	    clock_t end = clock();
+	    fclose (f);
+
+	    printf ("Exported %d keys\n", count);
+	    printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+	} else if (strncmp (command, "merge ", 6) == 0 &&
+		   sscanf (command + 6, "%15s %255[^\n]", (char *) ukey,
+			   key) == 2) {
+	    MergeValues merger;
+	    const char *policy = (const char *) ukey;
+
+	    if (strcmp (policy, "keep") == 0)
+		merger.policy = MergeValues::KEEP;
+	    else if (strcmp (policy, "replace") == 0)
+		merger.policy = MergeValues::REPLACE;
+	    else if (strcmp (policy, "sum") == 0)
+		merger.policy = MergeValues::SUM;
+	    else {
+		printf ("Unknown policy %s\n", policy);
+		continue;
+	    }
+
+	    try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		std::vector<const unsigned char *> words, keys;
+		std::vector<int> counts;
+		const unsigned char *word;
+		size_t len;
+		unsigned long long count;
+
+		while ((word = list.Next(&len, &count))) {
+		    words.push_back(word);
+		    counts.push_back(count);
+		}
+		keys = words;
+
+		// the other double array and its values by id
+		unlink ("merge.base");
+		unlink ("merge.check");
+		mada::DoubleArray<IndexType, unsigned char> other("merge.base",
+								  "merge.check",
+								  term,
+								  UCHAR_MAX, 1);
+		other.Build (keys, 1);
+
+		std::vector<int> values(other.IdLimit(), 0);
+		for (size_t i = 0; i < words.size(); i++)
+		    values[other.SearchId (words[i])] = counts[i];
+
+		// naive merge: add all words of both to a new double array
+		clock_t start = clock();
 		{
-		    key[len-1] = term; /* replace '\n' with terminal symbol */
-		    s2us (ukey, key);
-		    if (da.Search (ukey)) {
-//			key[len-1] = '\0';
-//			printf("FOUND \"%s\".\n", key);
-		    } else {
-			key[len-1] = '\0';
-			printf("Failed to find \"%s\".\n", key);
+		    unlink ("naive.base");
+		    unlink ("naive.check");
+		    mada::DoubleArray<IndexType, unsigned char> naive("naive.base",
+								      "naive.check",
+								      term,
+								      UCHAR_MAX, 1);
+		    mada::Cursor<IndexType, unsigned char> c(da);
+		    for (int ok = c.Begin (); ok; ok = c.Next ())
+			naive.Add (c.Key ());
+		    for (size_t i = 0; i < words.size(); i++)
+			naive.Add (words[i]);
+		}
+		clock_t mid = clock();
+		unlink ("naive.base");
+		unlink ("naive.check");
+
+		merger.attr = attr.IsValid() ? &attr : NULL;
+		merger.values = &values;
+		merger.conflicts = 0;
+
+		clock_t mid2 = clock();
+		IndexType added = da.Merge (other, merger);
+		clock_t end = clock();
+
+		printf ("Added %lld keys, %lu conflicts\n", (long long) added,
+			(unsigned long) merger.conflicts);
+		printf ("merge: %f sec, re-insertion: %f sec\n",
+			(float)(end-mid2)/(float)CLOCKS_PER_SEC,
+			(float)(mid-start)/(float)CLOCKS_PER_SEC);
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
+	    }
+	    unlink ("merge.base");
+	    unlink ("merge.check");
+	} else if (strncmp (command, "relayout\n", 9) == 0) {
+	    clock_t start = clock();
+	    IndexType size = da.Relayout();
+	    clock_t end = clock();
+
+	    printf ("Size of array: %lld\n", (long long) size);
+	    printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+	} else if (strncmp (command, "relayout_profile ", 17) == 0 &&
+		   command[17] != '\0') {
+	    strcpy (key, command + 17);
+	    key[strlen(key)-1] = '\0';
+
+	    clock_t start = clock();
+	    IndexType size = da.RelayoutByProfile(key);
+	    clock_t end = clock();
+
+	    if (size < 0) {
+		printf ("Failed to open %s\n", key);
+	    } else {
+		printf ("Size of array: %lld\n", (long long) size);
+		printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+	    }
+	} else if (strncmp (command, "bench_search ", 13) == 0 &&
+		   sscanf (command + 13, "%d %255[^\n]", &k, key) == 2) {
+	    try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		std::vector<const unsigned char *> words;
+		const unsigned char *word;
+		size_t len;
+		unsigned long long count;
+
+		// A line "count\tword" is looked up "count" times.
+		while ((word = list.Next(&len, &count)))
+		    words.insert(words.end(), count, word);
+
+		srand (1);
+		std::random_shuffle (words.begin(), words.end());
+
+		PerfCounters counters;
+		size_t found = 0;
+		struct timeval start, end;
+
+		gettimeofday (&start, NULL);
+		counters.Start();
+		for (int r = 0; r < k; r++)
+		    for (size_t i = 0; i < words.size(); i++)
+			found += da.Search (words[i]) != 0;
+		counters.Stop();
+		gettimeofday (&end, NULL);
+
+		size_t lookups = words.size() * (k > 0 ? k : 0);
+		double sec = (end.tv_sec - start.tv_sec) +
+		    (end.tv_usec - start.tv_usec) / 1000000.0;
+
+		printf ("%lu lookups, %lu found\n",
+			(unsigned long) lookups, (unsigned long) found);
+		if (lookups > 0)
+		    printf ("%.1f ns/lookup\n", sec * 1e9 / lookups);
+		counters.Print(lookups);
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
+	    }
+	} else if (strncmp (command, "bench_batch ", 12) == 0 &&
+		   sscanf (command + 12, "%d %255[^\n]", &k, key) == 2) {
+	    try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		std::vector<const unsigned char *> words;
+		const unsigned char *word;
+		size_t len;
+		unsigned long long count;
+
+		while ((word = list.Next(&len, &count)))
+		    words.insert(words.end(), count, word);
+
+		srand (1);
+		std::random_shuffle (words.begin(), words.end());
+
+		// width 0 is a loop of Search()
+		static const int widths[] = { 0, 1, 2, 4, 8, 16, 32 };
+		std::vector<IndexType> expected(words.size()), results(words.size());
+		double plain = 0;
+
+		for (size_t i = 0; i < words.size(); i++)
+		    expected[i] = da.Search (words[i]);
+
+		printf ("width\tns/lookup\tspeedup\n");
+		for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+		    struct timeval start, end;
+
+		    gettimeofday (&start, NULL);
+		    for (int r = 0; r < k; r++) {
+			if (widths[w] == 0)
+			    for (size_t i = 0; i < words.size(); i++)
+				results[i] = da.Search (words[i]);
+			else if (!words.empty())
+			    da.SearchBatch (&words[0], words.size(), &results[0],
+					    widths[w]);
 		    }
+		    gettimeofday (&end, NULL);
+
+		    double ns = ((end.tv_sec - start.tv_sec) * 1e9 +
+				 (end.tv_usec - start.tv_usec) * 1e3) /
+			((double) words.size() * (k > 0 ? k : 1));
+		    if (widths[w] == 0)
+			plain = ns;
+
+		    printf ("%s%d\t%.1f\t%.2f%s\n", widths[w] ? "" : "search ",
+			    widths[w], ns, ns > 0 ? plain / ns : 0.0,
+			    results == expected ? "" : "\tMISMATCH");
 		}
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
 	    }
+	} else if (strncmp (command, "bench_key ", 10) == 0 &&
+		   sscanf (command + 10, "%d %255[^\n]", &k, key) == 2) {
+	    try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		std::vector<IndexType> ids, leaves;
+		const unsigned char *word;
+		size_t len, bytes = 0;
+
+		while ((word = list.Next(&len))) {
+		    IndexType id = da.SearchId (word);
+		    if (id >= 0) {
+			ids.push_back(id);
+			bytes += len;
+		    }
+		}
+
+		srand (1);
+		std::random_shuffle (ids.begin(), ids.end());
+
+		clock_t start = clock();
+		da.GetLeaves (leaves);
+		clock_t mid = clock();
+
+		size_t restored = 0;
+		for (int r = 0; r < k; r++) {
+		    for (size_t i = 0; i < ids.size(); i++) {
+			int n = da.Key (leaves[ids[i]], ukey, sizeof(ukey));
+			if (n >= 0 && (size_t) n < sizeof(ukey))
+			    restored++;
+		    }
+		}
+		clock_t end = clock();
+
+		double sec = (double) (end - mid) / CLOCKS_PER_SEC;
+		printf ("Table of %lu ids: %f sec\n", (unsigned long) leaves.size(),
+			(float)(mid-start)/(float)CLOCKS_PER_SEC);
+		printf ("%lu keys restored\n", (unsigned long) restored);
+		if (restored > 0)
+		    printf ("%.1f ns/key, %.1f MB/s\n", sec * 1e9 / restored,
+			    (double) bytes * k / sec / 1e6);
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
+	    }
+	} else if (strncmp (command, "bench_threads ", 14) == 0 &&
+		   sscanf (command + 14, "%d %255[^\n]", &k, key) == 2) {
+	    try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		std::vector<const unsigned char *> words;
+		const unsigned char *word;
+		size_t len;
+
+		while ((word = list.Next(&len)))
+		    words.push_back(word);
+
+		srand (1);
+		std::random_shuffle (words.begin(), words.end());
+
+		// All threads share one double array through a const reference.
+		const mada::DoubleArray<IndexType, unsigned char> &reader = da;
+		double single = 0;
+
+		for (int n = 1; n <= k; n++) {
+		    std::vector<pthread_t> threads(n);
+		    std::vector<LookupJob> jobs(n);
+		    struct timeval start, end;
+
+		    gettimeofday (&start, NULL);
+		    for (int i = 0; i < n; i++) {
+			jobs[i].da = &reader;
+			jobs[i].words = &words;
+			jobs[i].offset = words.size() / n * i;
+			pthread_create (&threads[i], NULL, lookupWorker, &jobs[i]);
+		    }
+
+		    size_t found = 0;
+		    for (int i = 0; i < n; i++) {
+			pthread_join (threads[i], NULL);
+			found += jobs[i].found;
+		    }
+		    gettimeofday (&end, NULL);
+
+		    double sec = (end.tv_sec - start.tv_sec) +
+			(end.tv_usec - start.tv_usec) / 1000000.0;
+		    double rate = words.size() * n / sec / 1e6;
+		    if (n == 1)
+			single = rate;
 
+		    printf ("%d threads: %lu found, %.2f M lookups/s (x%.2f)\n",
+			    n, (unsigned long) found, rate, rate / single);
+		}
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
+	    }
+	} else if (strncmp (command, "filter ", 7) == 0 &&
+		   sscanf (command + 7, "%d", &k) == 1) {
+	    clock_t start = clock();
+	    filter.Build (k);
 	    clock_t end = clock();
 
-	    printf ("%f sec\n", (float)(end-start)/(float)CLOCKS_PER_SEC);
+	    printf ("Built the filter in %f sec\n",
+		    (float)(end-start)/(float)CLOCKS_PER_SEC);
+	} else if (strncmp (command, "bench_filter ", 13) == 0 &&
+		   sscanf (command + 13, "%d %255[^\n]", &k, key) == 2) {
+	    if (!filter.IsValid())
+		printf ("The filter is stale. Run \"filter n\" first.\n");
+	    else try {
+		mada::MappedWordList<unsigned char> list(key, term);
+		std::vector<const unsigned char *> hits;
+		std::vector<unsigned char> pool;
+		std::vector<size_t> misses;
+		const unsigned char *word;
+		size_t len;
 
-	    fclose (f);
+		// A word in the dictionary is a hit. The word followed by '#'
+		// is a miss unless it is in the dictionary too.
+		while ((word = list.Next(&len))) {
+		    if (da.Search (word) == 0)
+			continue;
+		    hits.push_back(word);
+
+		    size_t start = pool.size();
+		    pool.insert(pool.end(), word, word + len);
+		    pool.push_back('#');
+		    pool.push_back(term);
+		    if (da.Search (&pool[start]) == 0)
+			misses.push_back(start);
+		    else
+			pool.resize(start);
+		}
+
+		static const int ratios[] = { 100, 50, 10, 5, 1, 0 };
+		size_t tests = sizeof(ratios) / sizeof(ratios[0]);
+		srand (1);
+
+		if (hits.empty() || misses.empty() || k <= 0) {
+		    printf ("No words of %s in the dictionary\n", key);
+		    tests = 0;
+		} else
+		    printf ("hit%%\tsearch\tfilter\t(ns/lookup, %d lookups)\n", k);
+
+		for (size_t r = 0; r < tests; r++) {
+		    std::vector<const unsigned char *> queries(k);
+		    for (int i = 0; i < k; i++)
+			queries[i] = rand() % 100 < ratios[r] ?
+			    hits[rand() % hits.size()] :
+			    &pool[misses[rand() % misses.size()]];
+
+		    struct timeval start, mid, end;
+		    size_t found = 0, passed = 0;
+
+		    gettimeofday (&start, NULL);
+		    for (int i = 0; i < k; i++)
+			found += da.Search (queries[i]) != 0;
+		    gettimeofday (&mid, NULL);
+		    for (int i = 0; i < k; i++)
+			passed += filter.Search (queries[i]) != 0;
+		    gettimeofday (&end, NULL);
+
+		    double plain = (mid.tv_sec - start.tv_sec) * 1e9 +
+			(mid.tv_usec - start.tv_usec) * 1e3;
+		    double filtered = (end.tv_sec - mid.tv_sec) * 1e9 +
+			(end.tv_usec - mid.tv_usec) * 1e3;
+
+		    printf ("%d\t%.1f\t%.1f%s\n", ratios[r], plain / k,
+			    filtered / k, found == passed ? "" : "\tMISMATCH");
+		}
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
+	    }
+	} else if (strncmp (command, "bench_xcheck ", 13) == 0 &&
+		   sscanf (command + 13, "%d", &k) == 1) {
+	    benchXCheck(da, k);
+	} else if (strncmp (command, "bench_add ", 10) == 0 &&
+		   sscanf (command + 10, "%d %255[^\n]", &k, key) == 2) {
+	    try {
+		benchAdd(k, key, term);
+	    } catch (int e) {
+		printf ("Failed to open %s\n", key);
+	    }
 	} else if (strncmp (command, "dump\n", 5) == 0) {
 	    da.dump();
 	} else if (strncmp (command, "info\n", 5) == 0) {
 	    da.printInfo();
+	} else if (strncmp (command, "verify\n", 7) == 0) {
+	    size_t problems = da.Verify (1);
+	    printf ("%lu problems\n", (unsigned long) problems);
+	} else if (strncmp (command, "check_compact ", 14) == 0 &&
+		   sscanf (command + 14, "%d %u", &k, &seed) == 2) {
+	    runCompactCheck (k, seed);
+	} else if (strncmp (command, "fuzz ", 5) == 0 &&
+		   sscanf (command + 5, "%d %u", &k, &seed) == 2) {
+	    runFuzz (k, seed);
+	} else if (strncmp (command, "memory\n", 7) == 0) {
+	    da.printMemory();
+	} else if (strncmp (command, "warm ", 5) == 0 &&
+		   sscanf (command + 5, "%d", &k) == 1) {
+	    struct timeval start, end;
+
+	    gettimeofday (&start, NULL);
+	    size_t pages = da.WarmUp(k);
+	    gettimeofday (&end, NULL);
+
+	    printf ("Read %lu pages of each array in %.3f ms\n",
+		    (unsigned long) pages,
+		    (end.tv_sec - start.tv_sec) * 1e3 +
+		    (end.tv_usec - start.tv_usec) / 1e3);
 	} else {
 	    printConsoleHelp ();
 	}
@@ -186,9 +1691,15 @@ void launchConsole(int init)
 
 int main(int argc, char* argv[])
 {
-    if (argc >= 2 && strcmp (argv[1], "init") == 0) {
-	printf ("Initializing ...\n");
-	launchConsole(1);
-    } else
-	launchConsole(0);
+    try {
+	if (argc >= 2 && strcmp (argv[1], "init") == 0) {
+	    printf ("Initializing ...\n");
+	    launchConsole(1);
+	} else
+	    launchConsole(0);
+    } catch (int e) {
+	printf ("Failed to open the double array (%d).\n", e);
+	printf ("Run \"%s init\" to create a new one.\n", argv[0]);
+	return 1;
+    }
 }